@@ -0,0 +1,316 @@
+#include <map>
+#include <future>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <arrayfire.h>
+
+#include "include/genetic_algorithm.hpp"
+#include "include/painter.hpp"
+#include "include/packer.hpp"
+
+
+namespace fs = std::filesystem;
+
+
+/*
+ * A line of the manifest:
+ * paint <target> <brush> <output> [key=value ...]
+ * pack <target> <objects_dir> <output> [key=value ...]
+ */
+struct Job
+{
+    std::string mode;
+    std::string target;
+    std::string source; // brush for paint, objects directory for pack
+    std::string output;
+    std::map<std::string, std::string> params;
+    int line = 0;
+};
+
+
+/*
+ * Images of a job, already on the device
+ */
+struct Decoded
+{
+    bool ok = false;
+    af::array target;
+    af::array brush;
+    std::vector<af::array> objects;
+    std::vector<std::string> objects_path;
+};
+
+
+const char* parse_option(const char* option, const char* deflt,
+    int argc, char**argv)
+{
+    for (int i=1; i<argc; i++)
+    {
+        if (std::strcmp(argv[i], option) == 0)
+            return argv[i+1];
+    }
+    return deflt;
+}
+
+
+template<typename T>
+T parse_option(const char* option, T deflt,
+    int argc, char**argv)
+{
+    for (int i=1; i<argc; i++)
+    {
+        if (std::strcmp(argv[i], option) == 0)
+        {
+            std::stringstream ss(argv[i+1]);
+            T t;
+            ss >> t;
+            return t;
+        }
+    }
+    return deflt;
+}
+
+
+/*
+ * Reads a job parameter, returning deflt if it was not given
+ */
+template<typename T>
+T param(const Job& job, const char* key, T deflt)
+{
+    auto it = job.params.find(key);
+    if (it == job.params.end())
+        return deflt;
+    std::stringstream ss(it->second);
+    T t;
+    ss >> t;
+    return t;
+}
+
+
+/*
+ * Reads the manifest, skipping empty lines and lines
+ * starting with #
+ */
+bool read_manifest(const char* path, std::vector<Job>& jobs)
+{
+    std::ifstream infile(path);
+    if (!infile)
+    {
+        std::cout << "Could not open manifest " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int n = 0;
+    while (std::getline(infile, line))
+    {
+        n++;
+        std::stringstream ss(line);
+        Job job;
+        job.line = n;
+        if (!(ss >> job.mode) || job.mode[0] == '#')
+            continue;
+
+        if ((job.mode != "paint" && job.mode != "pack") ||
+            !(ss >> job.target >> job.source >> job.output))
+        {
+            std::cout << "Skipping malformed line " << n <<
+                " of " << path << std::endl;
+            continue;
+        }
+
+        std::string kv;
+        while (ss >> kv)
+        {
+            size_t eq = kv.find('=');
+            if (eq == std::string::npos)
+                std::cout << "Ignoring parameter " << kv <<
+                    " in line " << n << std::endl;
+            else
+                job.params[kv.substr(0, eq)] = kv.substr(eq + 1);
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+
+/*
+ * Loads the images of a job. Runs on its own thread
+ * while the previous job is optimizing
+ */
+Decoded decode(const Job& job, int device)
+{
+    af::setDevice(device);
+
+    Decoded d;
+    if (!fs::exists(job.target) || !fs::exists(job.source))
+    {
+        std::cout << "Missing input for job in line " << job.line << std::endl;
+        return d;
+    }
+
+    try
+    {
+        d.target = af::loadImage(job.target.c_str(), 1) / 255.f;
+        if (job.mode == "paint")
+        {
+            d.brush = af::loadImage(job.source.c_str(), true) / 255.f;
+        }
+        else
+        {
+            for (const auto & entry : fs::directory_iterator(job.source))
+                d.objects_path.push_back(entry.path());
+            // keep the slots deterministic between runs
+            std::sort(d.objects_path.begin(), d.objects_path.end());
+            for (const std::string& path : d.objects_path)
+                d.objects.push_back(af::loadImage(path.c_str(), 1) / 255.f);
+        }
+        af::eval(d.target, d.brush);
+        for (af::array& obj : d.objects)
+            obj.eval();
+        af::sync();
+        d.ok = true;
+    }
+    catch (const af::exception& e)
+    {
+        std::cout << "Could not decode job in line " << job.line <<
+            ": " << e.what() << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "Could not decode job in line " << job.line <<
+            ": " << e.what() << std::endl;
+    }
+    return d;
+}
+
+
+void paint(const Job& job, Decoded& d)
+{
+    Painter painter(d.target, d.brush,
+        param(job, "brush_scale", 0.5f),
+        param(job, "iters", 200),
+        param(job, "dna_size_x", 2048),
+        param(job, "dna_size_y", 3),
+        param(job, "loops", 20),
+        param(job, "pop_size", 100),
+        param(job, "var_weights", 1.0f),
+        param(job, "grad_weights", 1.2f));
+    painter.rotation_steps = param(job, "rotation_steps", 32);
+    painter.islands = param(job, "islands", 1);
+    painter.pyramid_levels = param(job, "pyramid_levels", 1);
+    painter.focus_tiles = param(job, "focus_tiles", 0);
+    painter.focus_tile_size = param(job, "focus_tile_size", 128);
+    painter.focus_concurrent = param(job, "focus_concurrent", 0);
+    painter.mutation_rate = param(job, "mutation_rate", 0.001f);
+    if (param(job, "convergence_window", 0) > 0)
+        painter.convergence = std::make_shared<ConvergenceController>(
+            param(job, "convergence_window", 0));
+    painter.checkpoint_path = param(job, "checkpoint", std::string());
+    painter.run();
+
+    af::array img = (painter.get_current_img() * 255).as(u8);
+    af::saveImageNative(job.output.c_str(), img);
+}
+
+
+void pack(const Job& job, Decoded& d)
+{
+    Packer packer(d.target, d.objects,
+        param(job, "scale", 0.05f), d.objects_path);
+    packer.area_weight = param(job, "area_weight", 800.0f);
+    packer.out_weight = param(job, "out_weight", 50.0f);
+    packer.selection_strategy = make_selection(
+        param(job, "selection", std::string("best")),
+        param(job, "tournament_size", 3));
+    packer.islands = param(job, "islands", 1);
+    packer.grid_cells = param(job, "grid_cells", 0);
+    if (param(job, "convergence_window", 0) > 0)
+        packer.convergence = std::make_shared<ConvergenceController>(
+            param(job, "convergence_window", 0));
+    packer.checkpoint_path = param(job, "checkpoint", std::string());
+
+    packer.run(param(job, "pop_size", 100),
+        param(job, "max_objs", 120),
+        param(job, "mutation_rate", 0.001f),
+        param(job, "iters", 800));
+    packer.save(job.output.c_str());
+}
+
+
+int main(int argc, char **argv)
+{
+    const char* manifest = parse_option("-f", "jobs.txt", argc, argv);
+    int device = parse_option("-d", 0, argc, argv);
+
+    std::vector<Job> jobs;
+    if (!read_manifest(manifest, jobs))
+        return 1;
+
+    af::setDevice(device);
+    af::info();
+
+    std::cout << "\nRunning " << jobs.size() << " jobs from " <<
+        manifest << "\n" << std::endl;
+
+    // the next job is decoded while the current one runs
+    std::future<Decoded> next;
+    if (!jobs.empty())
+        next = std::async(std::launch::async, decode, jobs[0], device);
+
+    int failed = 0;
+    for (int i=0; i<jobs.size(); i++)
+    {
+        Decoded d = next.get();
+        if (i + 1 < jobs.size())
+            next = std::async(std::launch::async, decode, jobs[i+1], device);
+
+        const Job& job = jobs[i];
+        if (!d.ok)
+        {
+            failed++;
+            continue;
+        }
+
+        std::cout << "\nJob " << i + 1 << "/" << jobs.size() << ": " <<
+            job.mode << " " << job.target << " -> " << job.output << std::endl;
+
+        af::timer t = af::timer::start();
+        try
+        {
+            if (job.mode == "paint")
+                paint(job, d);
+            else
+                pack(job, d);
+        }
+        catch (const af::exception& e)
+        {
+            std::cout << "Job in line " << job.line << " failed: " <<
+                e.what() << std::endl;
+            failed++;
+            continue;
+        }
+        // bad parameters, allocations or files only fail their job
+        catch (const std::exception& e)
+        {
+            std::cout << "Job in line " << job.line << " failed: " <<
+                e.what() << std::endl;
+            failed++;
+            continue;
+        }
+        std::cout << "Job " << i + 1 << " took " <<
+            af::timer::stop(t) << "s" << std::endl;
+    }
+
+    std::cout << "\nFinished " << jobs.size() - failed << "/" <<
+        jobs.size() << " jobs" << std::endl;
+
+    return failed > 0;
+}
@@ -0,0 +1,366 @@
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <functional>
+#include <arrayfire.h>
+
+#include "include/genetic_algorithm.hpp"
+#include "include/image_functions.hpp"
+#include "include/painter.hpp"
+#include "include/packer.hpp"
+
+
+const char* parse_option(const char* option, const char* deflt, 
+    int argc, char**argv)
+{
+    for (int i=1; i<argc; i++)
+    {
+        if (std::strcmp(argv[i], option) == 0)
+            return argv[i+1];
+    }
+    return deflt;
+}
+
+
+template<typename T>
+T parse_option(const char* option, T deflt, 
+    int argc, char**argv)
+{
+    for (int i=1; i<argc; i++)
+    {
+        if (std::strcmp(argv[i], option) == 0)
+        {
+            std::stringstream ss(argv[i+1]);
+            T t;
+            ss >> t;
+            return t;
+        }
+    }
+    return deflt;
+}
+
+
+/*
+ * Score used to time the algorithm on its own
+ */
+class SumScore : public Score
+{
+public:
+    const af::array fitness_func(af::array coords) override
+    {
+        return af::sum(af::sum(coords, 2), 1);
+    }
+};
+
+
+/*
+ * Times the hot paths of the algorithm, painter and packer
+ * on synthetic data. Each measurement runs once to warm up
+ * (kernel compilation) and then reps times, syncing the
+ * device after each run
+ */
+class Bench
+{
+public:
+    struct Result
+    {
+        std::string name;
+        std::string backend;
+        std::vector<std::pair<std::string, int>> params;
+        int reps;
+        double mean_ms;
+        double min_ms;
+    };
+
+    int reps = 5;
+    std::string backend;
+    std::vector<Result> results;
+
+    void measure(const std::string& name, 
+        std::vector<std::pair<std::string, int>> params,
+        std::function<af::array()> f)
+    {
+        f().eval();
+        af::sync();
+
+        std::vector<double> times;
+        for (int r=0; r<reps; r++)
+        {
+            af::timer t = af::timer::start();
+            f().eval();
+            af::sync();
+            times.push_back(1000 * af::timer::stop(t));
+        }
+        record(name, params, times);
+    }
+
+    /*
+     * Adds a result from the times of each repetition
+     */
+    void record(const std::string& name, 
+        std::vector<std::pair<std::string, int>> params,
+        const std::vector<double>& times)
+    {
+        double total = 0;
+        double best = std::numeric_limits<double>::infinity();
+        for (double elapsed : times)
+        {
+            total += elapsed;
+            best = std::min(best, elapsed);
+        }
+
+        int n = times.size();
+        results.push_back({name, backend, params, n, total / n, best});
+        std::cout << backend << " " << name;
+        for (auto& [key, value] : params)
+            std::cout << " " << key << "=" << value;
+        std::cout << ": " << total / n << " ms" << std::endl;
+    }
+
+    void genetic_algorithm(int pop_size, int dna_size)
+    {
+        SumScore score;
+        GeneticAlgorithm gal(pop_size, dna_size, 3, 0.001f, 1);
+        std::vector<std::pair<std::string, int>> params = {
+            {"pop_size", pop_size}, {"dna_size", dna_size}};
+
+        gal.step(score);
+        af::sync();
+
+        // step times each phase when given the metrics
+        std::vector<double> fitness, selection, crossover;
+        for (int r=0; r<reps; r++)
+        {
+            GenerationMetrics m;
+            gal.step(score, &m);
+            fitness.push_back(m.fitness_ms);
+            selection.push_back(m.selection_ms);
+            crossover.push_back(m.crossover_ms);
+        }
+        record("GeneticAlgorithm fitness", params, fitness);
+        record("GeneticAlgorithm selection", params, selection);
+        record("GeneticAlgorithm crossover+mutation", params, crossover);
+    }
+
+    void painter(int pop_size, int dna_size, int img_size)
+    {
+        Painter painter(af::randu(img_size, img_size, 3), 
+            af::randu(32, 32, 4), 1.0f, 1, dna_size, 3, 1, pop_size);
+        std::vector<std::pair<std::string, int>> params = {
+            {"pop_size", pop_size}, {"dna_size", dna_size}, 
+            {"img_size", img_size}};
+
+        af::array coords = af::randu(pop_size, dna_size, 3);
+        measure("Painter::fitness_func", params, [&]() {
+            return painter.fitness_func(coords);
+        });
+
+        af::array metainfo = af::randu(dna_size, 3);
+        measure("Painter::make_image", params, [&]() {
+            return painter.make_image(metainfo, false, 0, true);
+        });
+    }
+
+    void packer(int pop_size, int max_objs, int img_size)
+    {
+        std::vector<af::array> objs;
+        for (int i=0; i<8; i++)
+            objs.push_back(af::randu(32, 32, 4));
+
+        Packer packer((af::randu(img_size, img_size, 3) > 0.5f).as(f32), 
+            objs, 1.0f);
+        std::vector<int> slots(max_objs);
+        for (int i=0; i<max_objs; i++)
+            slots[i] = i % objs.size();
+        packer.load_slots(slots);
+
+        std::vector<std::pair<std::string, int>> params = {
+            {"pop_size", pop_size}, {"max_objs", max_objs}, 
+            {"img_size", img_size}};
+
+        af::array coords = af::randu(pop_size, max_objs, 4);
+        measure("Packer::fitness_func", params, [&]() {
+            return packer.fitness_func(coords);
+        });
+
+        // whole generations, so the incremental fitness
+        // sees the objects a real crossover changes
+        GeneticAlgorithm gal(pop_size, max_objs, 4, 0.001f, 1);
+        measure("Packer step", params, [&]() {
+            gal.step(packer);
+            return gal.get_best();
+        });
+        packer.incremental = true;
+        measure("Packer step incremental", params, [&]() {
+            gal.step(packer);
+            return gal.get_best();
+        });
+        packer.incremental = false;
+
+        packer.grid_cells = 16;
+        measure("Packer::fitness_func grid", params, [&]() {
+            return packer.fitness_func(coords);
+        });
+        packer.grid_cells = 0;
+
+        af::array coord = af::randu(max_objs, 4);
+        measure("Packer::make_image_bw", params, [&]() {
+            return packer.make_image_bw(coord);
+        });
+    }
+
+    /*
+     * Compares the incremental packer costs with a full redraw
+     * after changing a few objects, returns false if they differ.
+     * The objects have different sizes, so they are padded in
+     * the object store
+     */
+    bool check_incremental(int pop_size, int max_objs, int img_size)
+    {
+        std::vector<af::array> objs;
+        for (int i=0; i<8; i++)
+            objs.push_back((af::randu(17 + 4 * i, 32 - 2 * i, 4) > 0.3f).as(f32));
+
+        Packer packer((af::randu(img_size, img_size, 3) > 0.5f).as(f32), 
+            objs, 1.0f);
+        std::vector<int> slots(max_objs);
+        for (int i=0; i<max_objs; i++)
+            slots[i] = i % objs.size();
+        packer.load_slots(slots);
+
+        af::array coords = af::randu(pop_size, max_objs, 4);
+        packer.incremental = true;
+        packer.fitness_func(coords);
+
+        // few enough changes for the incremental path
+        af::array mutate = af::tile(
+            af::randu(pop_size, max_objs) < 0.01f, 1, 1, 4);
+        coords = af::select(mutate, af::randu(pop_size, max_objs, 4), coords);
+        af::array incremental = packer.fitness_func(coords);
+
+        packer.incremental = false;
+        af::array full = packer.fitness_func(coords);
+
+        float diff = af::max<float>(af::abs(incremental - full));
+        float scale = std::max(1.0f, af::max<float>(af::abs(full)));
+        bool ok = diff <= 1e-4f * scale;
+        std::cout << backend << " Packer incremental check img_size=" << 
+            img_size << ": " << (ok ? "ok" : "mismatch") << 
+            ", max difference " << diff << std::endl;
+        return ok;
+    }
+
+    void add_imgs(int img_size)
+    {
+        af::array brush = af::randu(32, 32, 4);
+        af::array background = af::constant(0, img_size, img_size, 4);
+        af::array x = af::constant(0.5f, 1);
+        af::array y = af::constant(0.5f, 1);
+
+        measure("ifs::add_imgs", {{"img_size", img_size}}, [&]() {
+            // add_imgs rotates the foreground in place
+            af::array foreground = brush.copy();
+            return ifs::add_imgs(foreground, background, 
+                x, y, 1, 0, 1, 0.3f);
+        });
+    }
+
+    void write_json(std::ostream& out) const
+    {
+        out << "{\n  \"context\": {\"library\": \"gal\"},\n";
+        out << "  \"benchmarks\": [\n";
+        for (int i=0; i<results.size(); i++)
+        {
+            const Result& r = results[i];
+            out << "    {\"name\": \"" << r.name << "\", \"backend\": \"" << 
+                r.backend << "\"";
+            for (auto& [key, value] : r.params)
+                out << ", \"" << key << "\": " << value;
+            out << ", \"iterations\": " << r.reps << 
+                ", \"real_time\": " << r.mean_ms <<
+                ", \"min_time\": " << r.min_ms << 
+                ", \"time_unit\": \"ms\"}" << 
+                (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}" << std::endl;
+    }
+};
+
+
+int main(int argc, char **argv)
+{
+    const char* backend = parse_option("-b", "all", argc, argv);
+    const char* out_path = parse_option("-o", "bench.json", argc, argv);
+    int reps = parse_option("-n", 5, argc, argv);
+    // only the smallest sizes, for quick checks
+    int quick = parse_option("-q", 0, argc, argv);
+    // the packer rasterizes every individual at once, so
+    // its biggest sizes need several GB and are opt-in
+    int large = parse_option("-l", 0, argc, argv);
+    const long long max_packer_pixels = 100LL * 512 * 512;
+
+    std::vector<int> pop_sizes = {50, 100, 200};
+    std::vector<int> dna_sizes = {512, 2048, 8192};
+    std::vector<int> img_sizes = {256, 512, 1024};
+    if (quick)
+    {
+        pop_sizes = {50};
+        dna_sizes = {512};
+        img_sizes = {256};
+    }
+
+    std::vector<std::pair<std::string, af_backend>> backends;
+    int available = af::getAvailableBackends();
+    if ((std::strcmp(backend, "all") == 0 || std::strcmp(backend, "cpu") == 0) &&
+        (available & AF_BACKEND_CPU))
+        backends.push_back({"cpu", AF_BACKEND_CPU});
+    if ((std::strcmp(backend, "all") == 0 || std::strcmp(backend, "opencl") == 0) &&
+        (available & AF_BACKEND_OPENCL))
+        backends.push_back({"opencl", AF_BACKEND_OPENCL});
+
+    if (backends.empty())
+    {
+        std::cout << "Backend " << backend << " is not available" << std::endl;
+        return 1;
+    }
+
+    Bench bench;
+    int failed_checks = 0;
+    bench.reps = reps;
+    for (auto& [name, b] : backends)
+    {
+        af::setBackend(b);
+        bench.backend = name;
+
+        if (!bench.check_incremental(20, 120, img_sizes[0]))
+            failed_checks++;
+
+        for (int pop_size : pop_sizes)
+            for (int dna_size : dna_sizes)
+                bench.genetic_algorithm(pop_size, dna_size);
+
+        for (int img_size : img_sizes)
+        {
+            for (int pop_size : pop_sizes)
+            {
+                for (int dna_size : dna_sizes)
+                    bench.painter(pop_size, dna_size, img_size);
+                if (large || (long long)pop_size * img_size * img_size <= 
+                    max_packer_pixels)
+                    bench.packer(pop_size, 120, img_size);
+            }
+            bench.add_imgs(img_size);
+        }
+    }
+
+    std::ofstream outfile(out_path);
+    bench.write_json(outfile);
+    std::cout << "Results written to " << out_path << std::endl;
+
+    return failed_checks > 0;
+}
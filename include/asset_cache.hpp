@@ -0,0 +1,363 @@
+#pragma once
+
+#include <map>
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arrayfire.h>
+
+
+/*
+ * Decodes object images on a pool of threads and keeps the
+ * resized results in a pack file, so later runs over the same
+ * images skip decoding. An entry is reused if its path, scale
+ * and modification time match.
+ *
+ * Pack file layout (little endian):
+ *  header (64 bytes):
+ *      "GALA" | u32 version | u32 n_entries | u32 reserved |
+ *      u64 table_offset | u64 data_offset | padding
+ *  entry table at table_offset, per entry:
+ *      u32 path length | bytes | i64 mtime | f32 scale |
+ *      u32 size_x | u32 size_y | u32 channels | u64 offset
+ *  pixels at each entry offset (64 byte aligned, so the file
+ *  can be mapped directly): (size_x, size_y, channels)
+ *  column major f32
+ */
+namespace asset_cache
+{
+    const uint32_t VERSION = 1;
+    const uint64_t ALIGNMENT = 64;
+
+    namespace
+    {
+        struct Header
+        {
+            char magic[4];
+            uint32_t version;
+            uint32_t n_entries;
+            uint32_t reserved;
+            uint64_t table_offset;
+            uint64_t data_offset;
+            char padding[32];
+        };
+
+        static_assert(sizeof(Header) == 64, "pack header must be 64 bytes");
+
+        struct Entry
+        {
+            std::string path;
+            int64_t mtime = 0;
+            float scale = 1.0f;
+            uint32_t size_x = 0;
+            uint32_t size_y = 0;
+            uint32_t channels = 0;
+            // points into the mapped pack or into pixels
+            const float* data = nullptr;
+            std::vector<float> pixels;
+        };
+
+
+        int64_t modification_time(const std::string& path)
+        {
+            std::error_code ec;
+            auto t = std::filesystem::last_write_time(path, ec);
+            return ec ? -1 : (int64_t)t.time_since_epoch().count();
+        }
+
+
+        /*
+         * Read only mapping of a pack file
+         */
+        class Pack
+        {
+        public:
+            Pack(const std::string& path)
+            {
+                int fd = open(path.c_str(), O_RDONLY);
+                if (fd < 0)
+                    return;
+
+                struct stat st;
+                if (fstat(fd, &st) == 0 && (uint64_t)st.st_size >= sizeof(Header))
+                {
+                    size = st.st_size;
+                    void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (ptr != MAP_FAILED)
+                        map = static_cast<const char*>(ptr);
+                }
+                close(fd);
+
+                if (map && !parse())
+                {
+                    std::cout << "Invalid asset cache " << path << std::endl;
+                    entries.clear();
+                }
+            }
+
+            ~Pack()
+            {
+                if (map)
+                    munmap(const_cast<char*>(map), size);
+            }
+
+            std::vector<Entry> entries;
+
+        private:
+            const char* map = nullptr;
+            size_t size = 0;
+
+            template<typename T>
+            bool read(uint64_t& pos, T& value) const
+            {
+                if (pos + sizeof(T) > size)
+                    return false;
+                std::memcpy(&value, map + pos, sizeof(T));
+                pos += sizeof(T);
+                return true;
+            }
+
+            bool parse()
+            {
+                Header header;
+                std::memcpy(&header, map, sizeof(Header));
+                if (std::string(header.magic, 4) != "GALA" ||
+                    header.version != VERSION)
+                    return false;
+
+                uint64_t pos = header.table_offset;
+                for (uint32_t i=0; i<header.n_entries; i++)
+                {
+                    Entry e;
+                    uint32_t length;
+                    uint64_t offset;
+                    if (!read(pos, length) || pos + length > size)
+                        return false;
+                    e.path.assign(map + pos, length);
+                    pos += length;
+
+                    if (!read(pos, e.mtime) || !read(pos, e.scale) ||
+                        !read(pos, e.size_x) || !read(pos, e.size_y) ||
+                        !read(pos, e.channels) || !read(pos, offset))
+                        return false;
+
+                    uint64_t bytes = (uint64_t)e.size_x * e.size_y *
+                        e.channels * sizeof(float);
+                    if (offset % ALIGNMENT != 0 || offset + bytes > size)
+                        return false;
+                    e.data = reinterpret_cast<const float*>(map + offset);
+                    entries.push_back(e);
+                }
+                return true;
+            }
+        };
+
+
+        bool save(const std::string& path, const std::vector<const Entry*>& entries)
+        {
+            std::ofstream outfile(path, std::ios::binary);
+            if (!outfile)
+            {
+                std::cout << "Could not open " << path << std::endl;
+                return false;
+            }
+
+            uint64_t table_size = 0;
+            for (const Entry* e : entries)
+                table_size += sizeof(uint32_t) + e->path.size() + sizeof(int64_t) +
+                    sizeof(float) + 3 * sizeof(uint32_t) + sizeof(uint64_t);
+
+            Header header = {{'G', 'A', 'L', 'A'}, VERSION,
+                (uint32_t)entries.size(), 0, sizeof(Header), 0, {}};
+            header.data_offset = (sizeof(Header) + table_size + ALIGNMENT - 1) /
+                ALIGNMENT * ALIGNMENT;
+
+            // offsets of each entry pixels
+            std::vector<uint64_t> offsets;
+            uint64_t offset = header.data_offset;
+            for (const Entry* e : entries)
+            {
+                offsets.push_back(offset);
+                uint64_t bytes = (uint64_t)e->size_x * e->size_y *
+                    e->channels * sizeof(float);
+                offset += (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+            }
+
+            auto write = [&outfile](const auto& value)
+            {
+                outfile.write(reinterpret_cast<const char*>(&value), sizeof(value));
+            };
+
+            write(header);
+            for (size_t i=0; i<entries.size(); i++)
+            {
+                const Entry* e = entries[i];
+                write((uint32_t)e->path.size());
+                outfile.write(e->path.data(), e->path.size());
+                write(e->mtime);
+                write(e->scale);
+                write(e->size_x);
+                write(e->size_y);
+                write(e->channels);
+                write(offsets[i]);
+            }
+
+            std::vector<char> padding(ALIGNMENT, 0);
+            uint64_t pos = sizeof(Header) + table_size;
+            for (size_t i=0; i<entries.size(); i++)
+            {
+                outfile.write(padding.data(), offsets[i] - pos);
+                uint64_t bytes = (uint64_t)entries[i]->size_x * entries[i]->size_y *
+                    entries[i]->channels * sizeof(float);
+                outfile.write(reinterpret_cast<const char*>(entries[i]->data), bytes);
+                pos = offsets[i] + bytes;
+            }
+
+            return (bool)outfile;
+        }
+    }
+
+
+    /*
+     * Loads the images at paths within the range of 0-1 and
+     * resizes them by scale, decoding on threads threads (0
+     * uses every core). If cache_path is set the pack file
+     * there is used and updated with the decoded images
+     */
+    std::vector<af::array> load(const std::vector<std::string>& paths,
+        float scale, const std::string& cache_path="", int threads=0)
+    {
+        std::vector<af::array> images(paths.size());
+        std::vector<int64_t> mtimes(paths.size());
+        for (size_t i=0; i<paths.size(); i++)
+            mtimes[i] = modification_time(paths[i]);
+
+        std::unique_ptr<Pack> pack;
+        std::map<std::pair<std::string, float>, const Entry*> cached;
+        if (!cache_path.empty())
+        {
+            pack = std::make_unique<Pack>(cache_path);
+            for (const Entry& e : pack->entries)
+                cached[{e.path, e.scale}] = &e;
+        }
+
+        std::vector<size_t> missing;
+        for (size_t i=0; i<paths.size(); i++)
+        {
+            auto it = cached.find({paths[i], scale});
+            if (it != cached.end() && it->second->mtime == mtimes[i])
+            {
+                const Entry* e = it->second;
+                images[i] = af::array(e->size_x, e->size_y, e->channels, e->data);
+            }
+            else
+            {
+                missing.push_back(i);
+            }
+        }
+
+        // decode what is not cached
+        std::vector<Entry> decoded(missing.size());
+        if (threads <= 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = std::min(threads, (int)missing.size());
+
+        int device = af::getDevice();
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> pool;
+        std::vector<std::exception_ptr> errors(threads);
+        for (int t=0; t<threads; t++)
+        {
+            pool.emplace_back([&, t]()
+            {
+                try
+                {
+                    af::setDevice(device);
+                    for (size_t j = next++; j < missing.size(); j = next++)
+                    {
+                        size_t i = missing[j];
+                        af::array img = af::loadImage(paths[i].c_str(), 1) / 255.f;
+                        img = af::resize(scale, img, AF_INTERP_BILINEAR);
+
+                        Entry& e = decoded[j];
+                        e.path = paths[i];
+                        e.mtime = mtimes[i];
+                        e.scale = scale;
+                        e.size_x = img.dims(0);
+                        e.size_y = img.dims(1);
+                        e.channels = img.dims(2);
+                        e.pixels.resize(img.elements());
+                        img.host(e.pixels.data());
+                        e.data = e.pixels.data();
+                        images[i] = img;
+                    }
+                }
+                catch (...)
+                {
+                    errors[t] = std::current_exception();
+                }
+            });
+        }
+        for (auto& thread : pool)
+            thread.join();
+        for (auto& error : errors)
+            if (error)
+                std::rethrow_exception(error);
+
+        std::cout << "Loaded " << paths.size() << " objects, " <<
+            paths.size() - missing.size() << " from cache" << std::endl;
+
+        if (cache_path.empty() || missing.empty())
+            return images;
+
+        // the new images replace their old entries. The images
+        // of this run keep only this scale, and the other entries
+        // are kept for other runs while their files are unchanged
+        for (const Entry& e : decoded)
+            cached[{e.path, e.scale}] = &e;
+        std::map<std::string, bool> current;
+        for (const std::string& path : paths)
+            current[path] = true;
+        std::vector<const Entry*> entries;
+        for (auto& kv : cached)
+        {
+            const Entry* e = kv.second;
+            if (current.count(e->path) ? e->scale == scale :
+                modification_time(e->path) == e->mtime)
+                entries.push_back(e);
+        }
+
+        // a unique temporary file, runs may share the cache
+        std::string tmp_path = cache_path + ".XXXXXX";
+        int fd = mkstemp(&tmp_path[0]);
+        if (fd < 0)
+        {
+            std::cout << "Could not create " << tmp_path << std::endl;
+            return images;
+        }
+        // mkstemp creates it private, other users and
+        // jobs sharing the cache must be able to read it
+        fchmod(fd, 0644);
+        close(fd);
+
+        if (save(tmp_path, entries))
+            std::rename(tmp_path.c_str(), cache_path.c_str());
+        else
+            std::remove(tmp_path.c_str());
+
+        return images;
+    }
+}
@@ -0,0 +1,305 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <future>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <functional>
+#include <arrayfire.h>
+
+
+/*
+ * Host copy of named arrays and values that can be
+ * written to and read from a binary file.
+ *
+ * File layout (little endian):
+ *  "GALC" | u32 version | u32 entries
+ *  per entry: u8 kind | u32 name length | name | payload
+ *  kind 0 (array): 4 x i64 dims | f32 data
+ *  kind 1 (int): i64
+ *  kind 2 (float): f64
+ */
+class Checkpoint
+{
+public:
+    static const uint32_t VERSION = 1;
+
+    /*
+     * Copies the array to the host, this waits
+     * for the device
+     */
+    void set(const std::string& name, const af::array& arr);
+    void set(const std::string& name, long long value);
+    void set(const std::string& name, double value);
+
+    bool has(const std::string& name) const;
+    af::array get_array(const std::string& name) const;
+    long long get_int(const std::string& name) const;
+    double get_float(const std::string& name) const;
+
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+
+private:
+    struct HostArray
+    {
+        af::dim4 dims;
+        std::vector<float> data;
+    };
+
+    std::map<std::string, HostArray> arrays;
+    std::map<std::string, long long> ints;
+    std::map<std::string, double> floats;
+};
+
+
+/*
+ * Saves checkpoints to a file on a background thread.
+ * The file is written next to the destination and then
+ * renamed, so a crash never leaves a half written file
+ */
+class Checkpointer
+{
+public:
+    Checkpointer(std::string path, int interval=50);
+    ~Checkpointer();
+
+    /*
+     * Adds the owner state and writes the checkpoint
+     * without waiting for the disk
+     */
+    void save(Checkpoint ckpt);
+    /*
+     * Loads the last checkpoint, returns false
+     * if there is none
+     */
+    bool load(Checkpoint& ckpt);
+    /*
+     * Waits for the pending write
+     */
+    void wait();
+
+    std::string path;
+    // generations between checkpoints
+    int interval;
+    /*
+     * Called before each save so the owner
+     * can add its own state
+     */
+    std::function<void(Checkpoint&)> add_state;
+
+private:
+    std::future<void> pending;
+};
+
+
+void Checkpoint::set(const std::string& name, const af::array& arr)
+{
+    HostArray h;
+    h.dims = arr.dims();
+    h.data.resize(arr.elements());
+    arr.as(f32).host(h.data.data());
+    arrays[name] = std::move(h);
+}
+
+
+void Checkpoint::set(const std::string& name, long long value)
+{
+    ints[name] = value;
+}
+
+
+void Checkpoint::set(const std::string& name, double value)
+{
+    floats[name] = value;
+}
+
+
+bool Checkpoint::has(const std::string& name) const
+{
+    return arrays.count(name) || ints.count(name) || floats.count(name);
+}
+
+
+af::array Checkpoint::get_array(const std::string& name) const
+{
+    const HostArray& h = arrays.at(name);
+    return af::array(h.dims, h.data.data());
+}
+
+
+long long Checkpoint::get_int(const std::string& name) const
+{
+    return ints.at(name);
+}
+
+
+double Checkpoint::get_float(const std::string& name) const
+{
+    return floats.at(name);
+}
+
+
+bool Checkpoint::save(const std::string& path) const
+{
+    std::ofstream outfile(path, std::ios::binary);
+    if (!outfile)
+    {
+        std::cout << "Could not open " << path << std::endl;
+        return false;
+    }
+
+    auto write = [&outfile](const auto& value) {
+        outfile.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    auto write_name = [&outfile, &write](uint8_t kind, const std::string& name) {
+        write(kind);
+        write((uint32_t)name.size());
+        outfile.write(name.data(), name.size());
+    };
+
+    outfile.write("GALC", 4);
+    write(VERSION);
+    write((uint32_t)(arrays.size() + ints.size() + floats.size()));
+
+    for (auto& [name, h] : arrays)
+    {
+        write_name(0, name);
+        for (int d=0; d<4; d++)
+            write((int64_t)h.dims[d]);
+        outfile.write(reinterpret_cast<const char*>(h.data.data()), 
+            h.data.size() * sizeof(float));
+    }
+
+    for (auto& [name, value] : ints)
+    {
+        write_name(1, name);
+        write((int64_t)value);
+    }
+
+    for (auto& [name, value] : floats)
+    {
+        write_name(2, name);
+        write(value);
+    }
+
+    return (bool)outfile;
+}
+
+
+bool Checkpoint::load(const std::string& path)
+{
+    std::ifstream infile(path, std::ios::binary);
+    if (!infile)
+        return false;
+
+    auto read = [&infile](auto& value) {
+        infile.read(reinterpret_cast<char*>(&value), sizeof(value));
+    };
+
+    char magic[4];
+    uint32_t version;
+    uint32_t entries;
+    infile.read(magic, 4);
+    read(version);
+    read(entries);
+
+    if (!infile || std::string(magic, 4) != "GALC" || version != VERSION)
+    {
+        std::cout << "Invalid checkpoint " << path << std::endl;
+        return false;
+    }
+
+    for (uint32_t i=0; i<entries && infile; i++)
+    {
+        uint8_t kind;
+        uint32_t name_size;
+        read(kind);
+        read(name_size);
+        std::string name(name_size, '\0');
+        infile.read(&name[0], name_size);
+
+        if (kind == 0)
+        {
+            HostArray h;
+            for (int d=0; d<4; d++)
+            {
+                int64_t dim;
+                read(dim);
+                h.dims[d] = dim;
+            }
+            h.data.resize(h.dims.elements());
+            infile.read(reinterpret_cast<char*>(h.data.data()), 
+                h.data.size() * sizeof(float));
+            arrays[name] = std::move(h);
+        }
+        else if (kind == 1)
+        {
+            int64_t value;
+            read(value);
+            ints[name] = value;
+        }
+        else
+        {
+            double value;
+            read(value);
+            floats[name] = value;
+        }
+    }
+
+    if (!infile)
+    {
+        std::cout << "Truncated checkpoint " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+Checkpointer::Checkpointer(std::string path, int interval) :
+    path(path), interval(interval)
+{
+
+}
+
+
+Checkpointer::~Checkpointer()
+{
+    wait();
+}
+
+
+void Checkpointer::save(Checkpoint ckpt)
+{
+    if (add_state)
+        add_state(ckpt);
+
+    // only one write in flight
+    wait();
+
+    pending = std::async(std::launch::async, 
+        [ckpt = std::move(ckpt), path = path]()
+        {
+            std::string tmp_path = path + ".tmp";
+            if (ckpt.save(tmp_path))
+                std::rename(tmp_path.c_str(), path.c_str());
+        });
+}
+
+
+bool Checkpointer::load(Checkpoint& ckpt)
+{
+    wait();
+    return ckpt.load(path);
+}
+
+
+void Checkpointer::wait()
+{
+    if (pending.valid())
+        pending.get();
+}
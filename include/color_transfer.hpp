@@ -1,6 +1,5 @@
 #pragma once
 
-#include <cstdio>
 #include <string>
 #include <iostream>
 #include <arrayfire.h>
@@ -10,49 +9,190 @@ namespace color_transfer
 {
     namespace
     {
-        const char* OUT_PATH = "tmp.jpg";
+        // linear rgb to xyz (D65)
+        const float RGB2XYZ[] = {
+            0.4124564f, 0.2126729f, 0.0193339f,
+            0.3575761f, 0.7151522f, 0.1191920f,
+            0.1804375f, 0.0721750f, 0.9503041f
+        };
+        const float XYZ2RGB[] = {
+             3.2404542f, -0.9692660f,  0.0556434f,
+            -1.5371385f,  1.8760108f, -0.2040259f,
+            -0.4985314f,  0.0415560f,  1.0572252f
+        };
+        // D65 white point
+        const float WHITE[] = {0.95047f, 1.0f, 1.08883f};
+
+        const int BINS = 256;
+
+
+        /*
+         * Multiplies every pixel of the (W, H, 3) image
+         * by the column major 3x3 matrix m
+         */
+        af::array apply_matrix(const af::array& img, const float* m)
+        {
+            af::array pixels = af::moddims(img, img.dims(0) * img.dims(1), 3);
+            af::array mat(3, 3, m);
+            return af::moddims(af::matmul(pixels, mat.T()), img.dims());
+        }
     }
 
 
     /*
-    * Calls python color transfer functions and
-    * returns the results
-    */
-    af::array color_transfer(
-        std::string content_path, std::string style_path, std::string function)
+     * Converts an rgb image within the range of 0-1
+     * to the CIE LAB color space
+     */
+    af::array rgb2lab(const af::array& rgb)
     {
-        // the script will create a tmp file
-        std::string command = "python scripts/color_transfer.py " + 
-            content_path + " " + style_path + " " + function;
-        int status = system(
-            (command).c_str());
-        
-        if (status != 0)
-        {
-            std::cout << "Python call failed" << std::endl;
-            std::cout << "Error number: " << status << std::endl;
-        }
+        af::array linear = af::select(rgb <= 0.04045f, rgb / 12.92f,
+            af::pow((rgb + 0.055f) / 1.055f, 2.4f));
+        af::array xyz = apply_matrix(linear, RGB2XYZ);
+
+        af::array white(1, 1, 3, WHITE);
+        xyz /= af::tile(white, xyz.dims(0), xyz.dims(1));
+
+        const float e = 216.f / 24389.f;
+        const float k = 24389.f / 27.f;
+        af::array f = af::select(xyz > e, af::cbrt(xyz), (k * xyz + 16) / 116);
+
+        af::array fx = f(af::span, af::span, 0);
+        af::array fy = f(af::span, af::span, 1);
+        af::array fz = f(af::span, af::span, 2);
+        return af::join(2, 116 * fy - 16, 500 * (fx - fy), 200 * (fy - fz));
+    }
+
+
+    /*
+     * Converts a CIE LAB image back to rgb, clamped to 0-1
+     */
+    af::array lab2rgb(const af::array& lab)
+    {
+        af::array fy = (lab(af::span, af::span, 0) + 16) / 116;
+        af::array fx = fy + lab(af::span, af::span, 1) / 500;
+        af::array fz = fy - lab(af::span, af::span, 2) / 200;
+        af::array f = af::join(2, fx, fy, fz);
+
+        const float e = 6.f / 29.f;
+        af::array xyz = af::select(f > e, f * f * f,
+            3 * e * e * (f - 4.f / 29.f));
 
-        af::array img = af::loadImage(OUT_PATH, 1) / 255.f;
-        
-        // remove the tmp file created
-        status = remove(OUT_PATH);
-        if (status != 0)
+        af::array white(1, 1, 3, WHITE);
+        xyz *= af::tile(white, xyz.dims(0), xyz.dims(1));
+
+        af::array linear = af::clamp(apply_matrix(xyz, XYZ2RGB), 0.0, 1.0);
+        return af::select(linear <= 0.0031308f, 12.92f * linear,
+            1.055f * af::pow(linear, 1 / 2.4f) - 0.055f);
+    }
+
+
+    /*
+     * Matches the mean and standard deviation of each LAB
+     * channel of content to the ones of style. Both are
+     * rgb(a) images within the range of 0-1, the content
+     * alpha is kept
+     */
+    af::array lab_transfer(const af::array& content, const af::array& style)
+    {
+        af::array content_lab = rgb2lab(content(af::span, af::span, af::seq(3)));
+        af::array style_lab = rgb2lab(style(af::span, af::span, af::seq(3)));
+
+        af::array content_flat = af::moddims(content_lab,
+            content_lab.dims(0) * content_lab.dims(1), 3);
+        af::array style_flat = af::moddims(style_lab,
+            style_lab.dims(0) * style_lab.dims(1), 3);
+
+        // (1, 1, 3) statistics of each channel
+        af::array content_mu = af::moddims(af::mean(content_flat, 0), 1, 1, 3);
+        af::array style_mu = af::moddims(af::mean(style_flat, 0), 1, 1, 3);
+        af::array content_std = af::moddims(
+            af::stdev(content_flat, AF_VARIANCE_POPULATION, 0), 1, 1, 3);
+        af::array style_std = af::moddims(
+            af::stdev(style_flat, AF_VARIANCE_POPULATION, 0), 1, 1, 3);
+
+        int w = content_lab.dims(0);
+        int h = content_lab.dims(1);
+        af::array lab = (content_lab - af::tile(content_mu, w, h)) *
+            af::tile(style_std / (content_std + 1e-6f), w, h) +
+            af::tile(style_mu, w, h);
+
+        af::array rgb = lab2rgb(lab);
+        if (content.dims(2) == 4)
+            rgb = af::join(2, rgb, content(af::span, af::span, 3));
+        return rgb;
+    }
+
+
+    /*
+     * Matches the cumulative histogram of each color channel
+     * of content to the one of style, interpolating between
+     * the style bins. Both are rgb(a) images within the
+     * range of 0-1, the content alpha is kept
+     */
+    af::array hist_transfer(const af::array& content, const af::array& style)
+    {
+        af::array result = content.copy();
+        af::array bin_values = (af::range(BINS) + 0.5f) / BINS;
+
+        for (int c=0; c<3; c++)
         {
-            std::cout << "Error deleting " << OUT_PATH << std::endl;
-            std::cout << "Error number: " << status << std::endl;
+            af::array content_channel = af::flat(content(af::span, af::span, c));
+            af::array style_channel = af::flat(style(af::span, af::span, c));
+
+            af::array content_cdf = af::accum(
+                af::histogram(content_channel, BINS, 0, 1).as(f32));
+            content_cdf /= content_channel.elements();
+            af::array style_cdf = af::accum(
+                af::histogram(style_channel, BINS, 0, 1).as(f32));
+            style_cdf /= style_channel.elements();
+
+            // for each content bin, the first style bin whose
+            // cdf reaches it, then interpolate with the one before
+            af::array below = af::tile(style_cdf, 1, BINS) <
+                af::tile(content_cdf.T(), BINS);
+            af::array hi = af::clamp(
+                af::sum(below.as(f32), 0).T(), 1.0, BINS - 1.0).as(s32);
+            af::array lo = hi - 1;
+
+            af::array cdf_lo = af::lookup(style_cdf, lo);
+            af::array cdf_hi = af::lookup(style_cdf, hi);
+            af::array t = af::clamp(
+                (content_cdf - cdf_lo) / (cdf_hi - cdf_lo + 1e-6f), 0.0, 1.0);
+            af::array lut = af::lookup(bin_values, lo) * (1 - t) +
+                af::lookup(bin_values, hi) * t;
+
+            af::array idx = af::clamp(
+                af::floor(content_channel * BINS), 0.0, BINS - 1.0).as(s32);
+            result(af::span, af::span, c) = af::moddims(
+                af::lookup(lut, idx), content.dims(0), content.dims(1));
         }
 
-        return img;
+        return result;
     }
 
+
     af::array lab_transfer(std::string content_path, std::string style_path)
     {
-        return color_transfer(content_path, style_path, "1");
+        return lab_transfer(af::loadImage(content_path.c_str(), 1) / 255.f,
+            af::loadImage(style_path.c_str(), 1) / 255.f);
     }
 
+
     af::array hist_transfer(std::string content_path, std::string style_path)
     {
-        return color_transfer(content_path, style_path, "0");
+        return hist_transfer(af::loadImage(content_path.c_str(), 1) / 255.f,
+            af::loadImage(style_path.c_str(), 1) / 255.f);
+    }
+
+
+    /*
+     * Transfers the colors of style to content. function
+     * is "1" for lab_transfer and "0" for hist_transfer
+     */
+    af::array color_transfer(
+        std::string content_path, std::string style_path, std::string function)
+    {
+        return function == "1" ? lab_transfer(content_path, style_path) :
+            hist_transfer(content_path, style_path);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+
+/*
+ * How a run of the genetic algorithm ended
+ */
+struct ConvergenceStats
+{
+    int generations = 0;
+    bool stopped_early = false;
+    float best_score = 0;
+    // best score improvement over the last window
+    float improvement = 0;
+    float mutation_rate = 0;
+};
+
+
+/*
+ * Tracks the best score of a run, checked once every window
+ * generations so the device is not synced every generation.
+ * After each window the mutation rate is adapted with the
+ * 1/5th success rule, counting the generations that improved
+ * the best score, and the run stops once the best score
+ * improved less than tolerance (relative) over the window
+ */
+class ConvergenceController
+{
+public:
+    ConvergenceController(int window=20, float tolerance=1e-4f) :
+        window(window), tolerance(tolerance) {}
+
+    int window;
+    float tolerance;
+    // never stop before this many generations
+    int min_generations = 0;
+    bool adapt_mutation = true;
+    // multiplies or divides the mutation rate
+    float factor = 1.5f;
+    float min_rate = 1e-5f;
+    float max_rate = 0.1f;
+
+    ConvergenceStats stats;
+
+    /*
+     * Starts tracking a new run
+     */
+    void reset(float mutation_rate);
+    /*
+     * Records the best score after another window generations,
+     * successes of which improved it, adapting mutation_rate.
+     * Returns false if the run should stop
+     */
+    bool update(float best_score, int successes, float& mutation_rate);
+
+private:
+    float last_best = 0;
+    bool has_last = false;
+};
+
+
+void ConvergenceController::reset(float mutation_rate)
+{
+    stats = ConvergenceStats();
+    stats.mutation_rate = mutation_rate;
+    has_last = false;
+}
+
+
+bool ConvergenceController::update(float best_score, int successes, 
+    float& mutation_rate)
+{
+    stats.generations += window;
+    stats.best_score = best_score;
+
+    if (adapt_mutation)
+    {
+        float success_rate = (float)successes / window;
+        if (success_rate > 0.2f)
+            mutation_rate *= factor;
+        else if (success_rate < 0.2f)
+            mutation_rate /= factor;
+        mutation_rate = std::min(max_rate, std::max(min_rate, mutation_rate));
+    }
+    stats.mutation_rate = mutation_rate;
+
+    // the first window has nothing to be compared with
+    if (!has_last)
+    {
+        last_best = best_score;
+        has_last = true;
+        return true;
+    }
+
+    stats.improvement = best_score - last_best;
+    float scale = std::max(std::abs(last_best), 1e-6f);
+    last_best = best_score;
+    if (stats.generations >= min_generations &&
+        stats.improvement / scale < tolerance)
+    {
+        stats.stopped_early = true;
+        return false;
+    }
+    return true;
+}
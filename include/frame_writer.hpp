@@ -0,0 +1,334 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <fstream>
+#include <csignal>
+#include <pthread.h>
+#include <iostream>
+#include <condition_variable>
+#include <arrayfire.h>
+
+
+/*
+ * Saves progress frames on a worker thread so the optimization
+ * does not wait on image encoding and disk I/O. Frames are
+ * copied into pinned host buffers and queued, and the policy
+ * decides what happens when the queue is full. Instead of
+ * image files the frames can be streamed raw into a pipe
+ */
+class FrameWriter
+{
+public:
+    enum Policy
+    {
+        BLOCK,       // wait until the worker makes room
+        DROP_NEWEST, // discard the frame being written
+        DROP_OLDEST  // discard the oldest queued frame
+    };
+
+    FrameWriter(size_t capacity=16, Policy policy=BLOCK);
+    /*
+     * Writes everything still queued and closes the pipe
+     */
+    ~FrameWriter();
+
+    /*
+     * Streams every frame as raw rgba bytes into the stdin
+     * of command instead of saving files. {width} and {height}
+     * in the command are replaced by the size of the first
+     * frame and later frames are resized to it
+     */
+    void open_pipe(const std::string& command);
+
+    /*
+     * Queues an u8 image to be saved at path, the path is
+     * ignored when streaming to a pipe. Returns false if
+     * the frame was dropped
+     */
+    bool write(const af::array& img, const std::string& path);
+    /*
+     * Queues a text file to be written at path
+     */
+    bool write_text(const std::string& path, const std::string& text);
+    /*
+     * Waits until every queued frame has been written
+     */
+    void flush();
+
+    int dropped() const;
+
+private:
+    struct Frame
+    {
+        std::string path;
+        std::string text;
+        af::dim4 dims;
+        unsigned char* data = nullptr;
+        size_t bytes = 0;
+    };
+
+    size_t capacity;
+    Policy policy;
+    int device;
+    int n_dropped = 0;
+
+    std::string pipe_command;
+    FILE* pipe = nullptr;
+    bool pipe_failed = false;
+    int pipe_width = 0;
+    int pipe_height = 0;
+
+    bool stop = false;
+    bool busy = false;
+    std::deque<Frame> queue;
+    // pinned buffers ready to be reused, all the frames
+    // of a run usually have the same size
+    std::vector<Frame> pool;
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::thread worker;
+
+    bool push(Frame frame);
+    void release(Frame& frame);
+    void work();
+    void save(Frame& frame);
+    /*
+     * Returns the image as interleaved rgba rows
+     * with the pipe size
+     */
+    af::array to_raw(const af::array& img);
+};
+
+
+FrameWriter::FrameWriter(size_t capacity, Policy policy) :
+    capacity(capacity), policy(policy)
+{
+    device = af::getDevice();
+    worker = std::thread(&FrameWriter::work, this);
+}
+
+
+FrameWriter::~FrameWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    cv.notify_all();
+    worker.join();
+
+    for (Frame& frame : pool)
+        af::freePinned(frame.data);
+
+    if (pipe)
+        pclose(pipe);
+}
+
+
+void FrameWriter::open_pipe(const std::string& command)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    pipe_command = command;
+}
+
+
+af::array FrameWriter::to_raw(const af::array& img)
+{
+    if (pipe_width == 0)
+    {
+        pipe_height = img.dims(0);
+        pipe_width = img.dims(1);
+    }
+
+    af::array rgba = img;
+    if (rgba.dims(0) != pipe_height || rgba.dims(1) != pipe_width)
+        rgba = af::resize(rgba, pipe_height, pipe_width);
+    if (rgba.dims(2) == 1)
+        rgba = af::tile(rgba, 1, 1, 3);
+    if (rgba.dims(2) == 3)
+        rgba = af::join(2, rgba,
+            af::constant(255, pipe_height, pipe_width, 1, u8));
+
+    // (channels, width, height) is interleaved row major
+    return af::reorder(rgba, 2, 1, 0);
+}
+
+
+bool FrameWriter::write(const af::array& img, const std::string& path)
+{
+    af::array frame_img = pipe_command.empty() ? img : to_raw(img);
+
+    Frame frame;
+    frame.path = path;
+    frame.dims = frame_img.dims();
+    frame.bytes = frame_img.bytes();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i=0; i<pool.size(); i++)
+        {
+            if (pool[i].bytes == frame.bytes)
+            {
+                frame.data = pool[i].data;
+                pool.erase(pool.begin() + i);
+                break;
+            }
+        }
+    }
+    if (!frame.data)
+        frame.data = (unsigned char*)af::pinned(frame.bytes, u8);
+
+    frame_img.as(u8).host(frame.data);
+    return push(frame);
+}
+
+
+bool FrameWriter::write_text(const std::string& path, const std::string& text)
+{
+    Frame frame;
+    frame.path = path;
+    frame.text = text;
+    return push(frame);
+}
+
+
+bool FrameWriter::push(Frame frame)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (queue.size() >= capacity)
+    {
+        if (policy == BLOCK)
+        {
+            cv.wait(lock, [this]{ return queue.size() < capacity; });
+        }
+        else if (policy == DROP_NEWEST)
+        {
+            n_dropped++;
+            release(frame);
+            return false;
+        }
+        else
+        {
+            n_dropped++;
+            release(queue.front());
+            queue.pop_front();
+        }
+    }
+    queue.push_back(frame);
+    lock.unlock();
+    cv.notify_all();
+    return true;
+}
+
+
+void FrameWriter::release(Frame& frame)
+{
+    // the mutex must be held
+    if (frame.data)
+        pool.push_back(frame);
+    frame.data = nullptr;
+}
+
+
+void FrameWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]{ return queue.empty() && !busy; });
+}
+
+
+int FrameWriter::dropped() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return n_dropped;
+}
+
+
+void FrameWriter::work()
+{
+    af::setDevice(device);
+
+    // a pipe whose reader exited makes fwrite fail instead
+    // of killing the process, SIGPIPE goes to the writing thread
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+    while (true)
+    {
+        Frame frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this]{ return stop || !queue.empty(); });
+            if (queue.empty())
+                return;
+            frame = queue.front();
+            queue.pop_front();
+            busy = true;
+        }
+        cv.notify_all();
+
+        save(frame);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            release(frame);
+            busy = false;
+        }
+        cv.notify_all();
+    }
+}
+
+
+void FrameWriter::save(Frame& frame)
+{
+    if (!frame.data)
+    {
+        std::ofstream outfile(frame.path);
+        outfile << frame.text;
+        return;
+    }
+
+    if (pipe_command.empty())
+    {
+        af::array img(frame.dims, frame.data, afHost);
+        af::saveImageNative(frame.path.c_str(), img);
+        return;
+    }
+
+    if (pipe_failed)
+        return;
+
+    if (!pipe)
+    {
+        std::string command = pipe_command;
+        auto replace = [&command](std::string key, int value)
+        {
+            size_t pos;
+            while ((pos = command.find(key)) != std::string::npos)
+                command.replace(pos, key.size(), std::to_string(value));
+        };
+        replace("{width}", pipe_width);
+        replace("{height}", pipe_height);
+
+        pipe = popen(command.c_str(), "w");
+        if (!pipe)
+        {
+            std::cout << "Could not open pipe " << command << std::endl;
+            pipe_failed = true;
+            return;
+        }
+    }
+    if (fwrite(frame.data, 1, frame.bytes, pipe) != frame.bytes)
+    {
+        std::cout << "Could not write to pipe " << pipe_command << 
+            ", dropping the next frames" << std::endl;
+        pipe_failed = true;
+    }
+}
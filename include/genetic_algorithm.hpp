@@ -1,9 +1,17 @@
 #pragma once
 
 
+#include <memory>
+#include <random>
 #include <iostream>
 #include <arrayfire.h>
 
+#include "selection.hpp"
+#include "checkpoint.hpp"
+#include "precision.hpp"
+#include "metrics.hpp"
+#include "convergence.hpp"
+
 
 class Score
 {
@@ -23,6 +31,32 @@ public:
      * Runs the algorithm
      */
     void run(Score& score, bool callback=0);
+    /*
+     * Runs a single generation. If m is given the
+     * phases are timed into it
+     */
+    void step(Score& score, GenerationMetrics* m=nullptr);
+    /*
+     * Returns k individuals to send to another population,
+     * the best of all generations followed by the current
+     * rows of the best scored lineages
+     */
+    af::array get_migrants(int k);
+    /*
+     * Replaces the rows of the worst scored lineages
+     * with the given individuals
+     */
+    void add_migrants(af::array migrants);
+    /*
+     * Saves the population, best individual, scores,
+     * generation and random seed into the checkpoint
+     */
+    void save_state(Checkpoint& ckpt);
+    /*
+     * Restores a state saved by save_state. Returns false
+     * if it does not match this algorithm sizes
+     */
+    bool load_state(const Checkpoint& ckpt);
     /*
      * Returns the best population individual
      */
@@ -31,21 +65,79 @@ public:
      * Returns the best population score
      */
     float get_best_score();
+    /*
+     * Restarts the random stream used to create and breed
+     * the population from seed and creates a new random
+     * population with it, so runs can be reproduced
+     */
+    void set_seed(unsigned long long seed);
+    unsigned long long get_seed();
     float mutation_rate;
+    /*
+     * Chooses the mate of each individual. Defaults
+     * to breeding everyone with the best
+     */
+    std::shared_ptr<SelectionStrategy> strategy = 
+        std::make_shared<BestSelection>();
+    /*
+     * Optional, saves the state every
+     * checkpointer->interval generations
+     */
+    Checkpointer* checkpointer = nullptr;
+    /*
+     * Format the population is kept in between
+     * generations. Genes are always bred in f32, so
+     * the f32 copy still exists during a generation.
+     * Stored genes stay below 1 in every format
+     */
+    precision::Storage gene_storage = precision::F32;
+    /*
+     * Optional, receives the metrics of every
+     * metrics_interval generations. Timing forces
+     * device syncs, so it is off by default
+     */
+    MetricsSink* metrics = nullptr;
+    int metrics_interval = 1;
+    /*
+     * Optional, adapts the mutation rate and stops the
+     * run once the best score stops improving. Its stats
+     * hold how the last run ended. The best score is read
+     * from the device every convergence->window generations
+     */
+    ConvergenceController* convergence = nullptr;
 
 private:
     int iters;
+    int generation = 0;
     int dna_size_x;
     int dna_size_y;
     int pop_size;
-    float best_score = -100000000;
     /*
-     * Best induvidual of all the generations
+     * Seed of the counter based random stream used
+     * to create and breed the population
      */
+    unsigned long long seed;
+    /*
+     * Best score and induvidual of all the generations.
+     * Both live on the device so a generation never has
+     * to wait for the host
+     */
+    af::array best_score;
     af::array best;
+    /*
+     * Scores of the last evaluated generation. Row i is
+     * the parent of the current row i
+     */
+    af::array last_scores;
+    /*
+     * Generations since the last convergence check that
+     * improved the best score, counted on the device
+     */
+    af::array successes;
     // each row is a member
     // number of columns are genes
     af::array population;
+    af::randomEngine engine;
 
     /*
      * Calculates fitness score and renews population
@@ -53,21 +145,19 @@ private:
      * receive the populationa and return the score for each member.
      * The algorithm tries to maxime this function
      */
-    void selection(Score& score);
+    void selection(Score& score, GenerationMetrics* m=nullptr);
     /*
      * Performs crossover on the population. Each
      * individual genes are combined with another
      */
     void crossover();
     /*
-     * "Breeds" the best specimen(the one with the highst score)
-     * with the rest of the population
-     */
-    void crossover(af::array row);
-    /*
-     * Mutates the population
+     * "Breeds" each individual of genes (the f32 population)
+     * with its mate (same row of mates) and mutates the result.
+     * bias is the (pop_size, 1) chance of taking each gene from
+     * the mate. Both steps share a single random draw
      */
-    void mutate();
+    void crossover(af::array genes, af::array mates, af::array bias);
     /*
      * Calculates the fitness score
      */
@@ -82,8 +172,32 @@ GeneticAlgorithm::GeneticAlgorithm(int _pop_size,
             mutation_rate(mutation_rate), iters(iters)
 {
     pop_size = _pop_size % 2 == 0 ? _pop_size : _pop_size + 1;
+
+    std::random_device dev;
+    set_seed(((unsigned long long)dev() << 32) | dev());
+}
+
+
+void GeneticAlgorithm::set_seed(unsigned long long _seed)
+{
+    seed = _seed;
+    engine = af::randomEngine(AF_RANDOM_ENGINE_PHILOX, seed);
+
     // creates a random population
-    population = af::randu(pop_size, dna_size_x, dna_size_y);
+    population = precision::store(
+        af::randu(af::dim4(pop_size, dna_size_x, dna_size_y), f32, engine),
+        gene_storage, true);
+    best = precision::load(population(0, af::span, af::span));
+    best_score = af::constant(-100000000, 1);
+    last_scores = af::constant(0, pop_size);
+    successes = af::constant(0, 1);
+    generation = 0;
+}
+
+
+unsigned long long GeneticAlgorithm::get_seed()
+{
+    return seed;
 }
 
 
@@ -95,78 +209,230 @@ GeneticAlgorithm::~GeneticAlgorithm()
 
 void GeneticAlgorithm::run(Score& score, bool callback)
 {
-    for (int i = 0; i < iters; i++)
+    int start = generation;
+    af::timer run_timer = af::timer::start();
+
+    if (convergence)
     {
-        selection(score);
-        mutate();
+        convergence->reset(mutation_rate);
+        successes = af::constant(0, 1);
+    }
+
+    for (int i = generation; i < iters; i++)
+    {
+        GenerationMetrics m;
+        bool measure = metrics && i % metrics_interval == 0;
+
+        step(score, measure ? &m : nullptr);
 
         if (callback && i % 50 == 0)
+        {
+            af::timer t = af::timer::start();
             score.callback(best, i);
+            if (measure)
+                m.callback_ms = metrics::lap(t, m);
+        }
+
+        if (measure)
+        {
+            m.generation = i;
+            m.device_bytes = metrics::device_bytes();
+            m.generations_per_sec = (i + 1 - start) / 
+                af::timer::stop(run_timer);
+            metrics->write(m);
+        }
+
+        if (checkpointer && (i + 1) % checkpointer->interval == 0)
+        {
+            Checkpoint ckpt;
+            save_state(ckpt);
+            checkpointer->save(ckpt);
+        }
         
 
         #ifndef NDEBUG
         if (i % 20 == 0)
         {
             std::cout << "iteration: " << i << std::endl;
-            std::cout << "Best score " << best_score << std::endl;
+            std::cout << "Best score " << get_best_score() << std::endl;
         }
         #endif
+
+        if (convergence && (i + 1 - start) % convergence->window == 0)
+        {
+            // a single read from the device every window
+            float state[2];
+            af::join(0, best_score.as(f32), successes).host(state);
+            successes = af::constant(0, 1);
+            if (!convergence->update(state[0], state[1], mutation_rate))
+                break;
+        }
     }
+
+    if (convergence)
+        convergence->stats.generations = generation - start;
 }
 
 
-void GeneticAlgorithm::selection(Score& score)
+void GeneticAlgorithm::step(Score& score, GenerationMetrics* m)
 {
-    af::array scores = score.fitness_func(population);
-    
-    af::array pop_best_scores;
-    af::array pop_best_idx;
-    af::max(pop_best_scores, pop_best_idx, scores, 0);
+    selection(score, m);
+    generation++;
+
+    // queue the generation without waiting for it
+    af::eval(population, best, best_score, successes);
+}
+
+
+af::array GeneticAlgorithm::get_migrants(int k)
+{
+    if (k <= 1)
+        return best;
+
+    af::array sorted;
+    af::array order;
+    af::sort(sorted, order, last_scores, 0, false);
+
+    return af::join(0, best, precision::load(
+        population(order(af::seq(k - 1)), af::span, af::span)));
+}
+
+
+void GeneticAlgorithm::add_migrants(af::array migrants)
+{
+    af::array sorted;
+    af::array order;
+    af::sort(sorted, order, last_scores, 0, true);
+
+    population(order(af::seq(migrants.dims(0))), af::span, af::span) = 
+        precision::store(migrants, gene_storage, true);
+}
 
-    float pop_best_score = pop_best_scores.scalar<float>();
 
-    // normalize scores
-    scores -= af::min(scores).scalar<float>();
-    scores /= af::sum(scores).scalar<float>();
+void GeneticAlgorithm::selection(Score& score, GenerationMetrics* m)
+{
+    af::timer t = af::timer::start();
+
+    af::array genes = precision::load(population);
+    af::array scores = score.fitness_func(genes);
+    last_scores = scores;
 
-    // this is stupid, arrayfire doesn't let
-    // me get the first element
-    int idx = af::sum<int>(pop_best_idx(0));
+    if (m)
+    {
+        scores.eval();
+        m->fitness_ms = metrics::lap(t, *m);
+        m->best = af::max<float>(scores);
+        m->mean = af::mean<float>(scores);
+        m->std = af::stdev<float>(scores);
+        t = af::timer::start();
+    }
     
-    af::array pop_best = population(idx,
+    af::array pop_best_score;
+    af::array pop_best_idx;
+    af::max(pop_best_score, pop_best_idx, scores, 0);
+
+    // indexing with the array keeps the index on the device
+    af::array pop_best = genes(pop_best_idx,
         af::span, af::span);
 
-    crossover(pop_best);
+    af::array mates_idx = strategy->select(scores, pop_size, engine);
+    af::array mates = genes(mates_idx, af::span, af::span);
+
+    // normalize scores, all of them are 0 if they were equal
+    scores -= af::tile(af::min(scores, 0), pop_size);
+    scores /= af::tile(af::sum(scores, 0) + 1e-12f, pop_size);
+
+    // the fitter parent passes on more genes, parents
+    // with the same lowest score pass on half each
+    af::array pair_scores = scores + scores(mates_idx);
+    af::array bias = strategy->proportional_crossover ?
+        af::select(pair_scores > 0, 
+            scores(mates_idx) / (pair_scores + 1e-6f), 0.5f) :
+        af::constant(0.5f, pop_size);
+
+    if (convergence)
+        successes += (pop_best_score > best_score).as(f32);
 
-    if (pop_best_score > best_score)
+    af::array improved = af::tile(pop_best_score > best_score, 
+        1, dna_size_x, dna_size_y);
+    best = af::select(improved, pop_best, best);
+    best_score = af::max(pop_best_score, best_score);
+
+    if (m)
+    {
+        af::eval(mates, bias, best, best_score);
+        m->selection_ms = metrics::lap(t, *m);
+    }
+
+    crossover(genes, mates, bias);
+
+    if (m)
     {
-        best = pop_best;
-        best_score = pop_best_score;
+        population.eval();
+        m->crossover_ms = metrics::lap(t, *m);
     }
 }
 
 
-void GeneticAlgorithm::crossover(af::array best)
+void GeneticAlgorithm::crossover(af::array genes, af::array mates, 
+    af::array bias)
 {
-    af::array r = af::randu(pop_size, dna_size_x, dna_size_y);
-    af::array idxs_replace = r < 0.5f; // should be based on score
+    // one 64 bit draw per gene: the lowest 16 bits pick the
+    // parent, the next 16 bits decide the mutation and the
+    // upper 24 bits are the mutated value. f32 holds 24 bits
+    // exactly, so it never rounds up to 1
+    af::array r = af::randu(af::dim4(pop_size, dna_size_x, dna_size_y), 
+        u64, engine);
+    af::array c = (r & 0xFFFF).as(f32) / 65536.0f;
+    af::array m = ((r >> 16) & 0xFFFF).as(f32) / 65536.0f;
+    af::array u = (r >> 40).as(f32) / 16777216.0f;
+
+    af::array idxs_replace = c < af::tile(bias, 1, dna_size_x, dna_size_y);
+
+    // change to a random value if m < than
+    // the mutation rate, else keep the bred value.
+    // everything is a single jit expression
+    population = precision::store(af::select(m < mutation_rate, u,
+        af::select(idxs_replace, mates, genes)),
+        gene_storage, true);
+}
 
-    population = 
-        idxs_replace * af::tile(best, pop_size) + 
-        (1 - idxs_replace) * population;
+
+void GeneticAlgorithm::save_state(Checkpoint& ckpt)
+{
+    ckpt.set("population", precision::load(population));
+    ckpt.set("best", best);
+    ckpt.set("best_score", best_score);
+    ckpt.set("last_scores", last_scores);
+    ckpt.set("generation", (long long)generation);
+    ckpt.set("seed", (long long)seed);
 }
 
 
-void GeneticAlgorithm::mutate()
+bool GeneticAlgorithm::load_state(const Checkpoint& ckpt)
 {
-    af::array r = af::randu(pop_size, dna_size_x, dna_size_y);
-    af::array u = af::randu(pop_size, dna_size_x, dna_size_y);
+    if (!ckpt.has("population"))
+        return false;
+
+    af::array _population = ckpt.get_array("population");
+    if (_population.dims() != af::dim4(pop_size, dna_size_x, dna_size_y))
+    {
+        std::cout << "Checkpoint population " << _population.dims() <<
+            " does not match the algorithm" << std::endl;
+        return false;
+    }
 
-    // change to a random value if r < than
-    // the mutation rate, else continue with
-    // the same value
-    population = (r < mutation_rate) * u + 
-        (r > mutation_rate) * population;
+    population = precision::store(_population, gene_storage, true);
+    best = ckpt.get_array("best");
+    best_score = ckpt.get_array("best_score");
+    last_scores = ckpt.get_array("last_scores");
+    generation = ckpt.get_int("generation");
+    seed = ckpt.get_int("seed");
+
+    // the engine position can't be saved, so the stream
+    // continues from a seed derived from the generation
+    engine = af::randomEngine(AF_RANDOM_ENGINE_PHILOX, seed + generation);
+    return true;
 }
 
 
@@ -178,5 +444,5 @@ af::array GeneticAlgorithm::get_best()
 
 float GeneticAlgorithm::get_best_score()
 {
-    return best_score;
+    return best_score.scalar<float>();
 }
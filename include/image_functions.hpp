@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <functional>
 #include <arrayfire.h>
 
@@ -21,6 +22,34 @@ namespace ifs
     }
 
 
+    /*
+     * Alpha blends the foreground into the background with its
+     * top left corner at (x, y). Whatever falls outside of the
+     * background is clipped
+     */
+    void blend_at(const af::array& foreground, af::array& background,
+        int x, int y)
+    {
+        int start_x = std::max(0, -x);
+        int start_y = std::max(0, -y);
+        int end_x = std::min((int)foreground.dims(0), 
+            (int)background.dims(0) - x);
+        int end_y = std::min((int)foreground.dims(1), 
+            (int)background.dims(1) - y);
+
+        if (end_x <= start_x || end_y <= start_y)
+            return;
+
+        af::array fg = foreground(af::seq(start_x, end_x - 1),
+            af::seq(start_y, end_y - 1), af::span);
+        af::seq bg_x(x + start_x, x + end_x - 1);
+        af::seq bg_y(y + start_y, y + end_y - 1);
+
+        background(bg_x, bg_y, af::span) = alpha_blend(fg, 
+            background(bg_x, bg_y, af::span), fg(af::span, af::span, -1));
+    }
+
+
     af::array add_imgs(af::array& foreground, 
         af::array& background, af::array _x, 
         af::array _y, float scale,
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <thread>
+#include <memory>
+#include <vector>
+#include <limits>
+#include <exception>
+#include <algorithm>
+#include <arrayfire.h>
+
+#include "genetic_algorithm.hpp"
+
+
+/*
+ * Runs several genetic algorithms at the same time, each
+ * one in its own thread on the current device, since the
+ * score data lives there. Every migration_interval
+ * generations the best individuals of each island are
+ * copied to the next one in a ring
+ */
+class IslandModel
+{
+public:
+    IslandModel(int islands, int pop_size, int dna_size_x,
+        int dna_size_y, float mutation_rate, int iters,
+        int migration_interval=20, int migrants=2);
+    ~IslandModel();
+    /*
+     * Runs the algorithm on every island
+     */
+    void run(Score& score, bool callback=0);
+    /*
+     * Returns the best individual across all islands
+     */
+    af::array get_best();
+    /* 
+     * Returns the best score across all islands
+     */
+    float get_best_score();
+
+    /*
+     * Selection strategy used by every island
+     */
+    std::shared_ptr<SelectionStrategy> strategy = 
+        std::make_shared<BestSelection>();
+    precision::Storage gene_storage = precision::F32;
+
+private:
+    int n_islands;
+    int pop_size;
+    int dna_size_x;
+    int dna_size_y;
+    float mutation_rate;
+    int iters;
+    int migration_interval;
+    int n_migrants;
+    // device the islands run on
+    int device = 0;
+    std::vector<std::unique_ptr<GeneticAlgorithm>> islands;
+
+    /*
+     * Runs f(i) for every island in its own thread
+     * with the device set
+     */
+    template<typename F>
+    void for_each_island(F f);
+    /*
+     * Sends the best individuals of each island
+     * to the next one
+     */
+    void migrate();
+};
+
+
+IslandModel::IslandModel(int islands, int pop_size, int dna_size_x,
+    int dna_size_y, float mutation_rate, int iters,
+    int migration_interval, int migrants) :
+        n_islands(islands), pop_size(pop_size), dna_size_x(dna_size_x),
+        dna_size_y(dna_size_y), mutation_rate(mutation_rate), iters(iters),
+        migration_interval(migration_interval), n_migrants(migrants)
+{
+
+}
+
+
+IslandModel::~IslandModel()
+{
+
+}
+
+
+template<typename F>
+void IslandModel::for_each_island(F f)
+{
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors(n_islands);
+
+    for (int i=0; i<n_islands; i++)
+    {
+        threads.emplace_back([this, i, &f, &errors]()
+        {
+            try
+            {
+                af::setDevice(device);
+                f(i);
+                af::sync();
+            }
+            catch (...)
+            {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    for (auto& error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+
+void IslandModel::run(Score& score, bool callback)
+{
+    device = af::getDevice();
+
+    islands.clear();
+    islands.resize(n_islands);
+    for_each_island([this](int i)
+    {
+        islands[i] = std::make_unique<GeneticAlgorithm>(pop_size, 
+            dna_size_x, dna_size_y, mutation_rate, iters);
+        islands[i]->strategy = strategy;
+        islands[i]->gene_storage = gene_storage;
+    });
+
+    for (int i = 0; i < iters; i += migration_interval)
+    {
+        int steps = std::min(migration_interval, iters - i);
+        for_each_island([this, &score, steps](int n)
+        {
+            for (int j=0; j<steps; j++)
+                islands[n]->step(score);
+        });
+
+        migrate();
+
+        if (callback && i / 50 != (i + steps) / 50)
+            score.callback(get_best(), i + steps);
+
+        #ifndef NDEBUG
+        std::cout << "iteration: " << i + steps << std::endl;
+        std::cout << "Best score " << get_best_score() << std::endl;
+        #endif
+    }
+}
+
+
+void IslandModel::migrate()
+{
+    if (n_islands < 2 || n_migrants < 1)
+        return;
+
+    // every island sends before any receives
+    std::vector<af::array> migrants(n_islands);
+    for (int i=0; i<n_islands; i++)
+        migrants[i] = islands[i]->get_migrants(n_migrants);
+
+    for (int i=0; i<n_islands; i++)
+        islands[(i + 1) % n_islands]->add_migrants(migrants[i]);
+}
+
+
+af::array IslandModel::get_best()
+{
+    int best_island = 0;
+    float best_score = -std::numeric_limits<float>::infinity();
+    for (int i=0; i<n_islands; i++)
+    {
+        float score = islands[i]->get_best_score();
+        if (score > best_score)
+        {
+            best_score = score;
+            best_island = i;
+        }
+    }
+
+    return islands[best_island]->get_best();
+}
+
+
+float IslandModel::get_best_score()
+{
+    float best_score = -std::numeric_limits<float>::infinity();
+    for (int i=0; i<n_islands; i++)
+        best_score = std::max(best_score, islands[i]->get_best_score());
+    return best_score;
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+
+
+/*
+ * Binary format of a packer result, it holds everything
+ * needed to render the layout again.
+ *
+ * File layout (little endian):
+ *  header (64 bytes):
+ *      "GALL" | u32 version | u32 n_objs | u32 n_genes |
+ *      u32 target_size_x | u32 target_size_y | f32 scale |
+ *      u32 n_paths | u64 paths_offset | u64 genes_offset | padding
+ *  path table at paths_offset: per path u32 length | bytes
+ *  slot table right after: u32 path index per object
+ *  genes at genes_offset (64 byte aligned, so the block can
+ *  be mapped directly): (n_objs, n_genes) column major f32
+ */
+namespace layout
+{
+    const uint32_t VERSION = 1;
+    const uint64_t ALIGNMENT = 64;
+
+    struct Layout
+    {
+        int target_size_x = 0;
+        int target_size_y = 0;
+        float scale = 1.0f;
+        int n_objs = 0;
+        int n_genes = 4;
+        // unique object paths
+        std::vector<std::string> paths;
+        // path index used by each object
+        std::vector<uint32_t> slots;
+        // (n_objs, n_genes) column major
+        std::vector<float> genes;
+    };
+
+
+    namespace
+    {
+        struct Header
+        {
+            char magic[4];
+            uint32_t version;
+            uint32_t n_objs;
+            uint32_t n_genes;
+            uint32_t target_size_x;
+            uint32_t target_size_y;
+            float scale;
+            uint32_t n_paths;
+            uint64_t paths_offset;
+            uint64_t genes_offset;
+            char padding[16];
+        };
+
+        static_assert(sizeof(Header) == 64, "layout header must be 64 bytes");
+    }
+
+
+    bool save(const std::string& path, const Layout& l)
+    {
+        std::ofstream outfile(path, std::ios::binary);
+        if (!outfile)
+        {
+            std::cout << "Could not open " << path << std::endl;
+            return false;
+        }
+
+        uint64_t table_size = 0;
+        for (auto& p : l.paths)
+            table_size += sizeof(uint32_t) + p.size();
+        table_size += l.slots.size() * sizeof(uint32_t);
+
+        Header header = {{'G', 'A', 'L', 'L'}, VERSION, 
+            (uint32_t)l.n_objs, (uint32_t)l.n_genes,
+            (uint32_t)l.target_size_x, (uint32_t)l.target_size_y,
+            l.scale, (uint32_t)l.paths.size(), sizeof(Header), 0, {}};
+        header.genes_offset = (sizeof(Header) + table_size + ALIGNMENT - 1) / 
+            ALIGNMENT * ALIGNMENT;
+
+        outfile.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+
+        for (auto& p : l.paths)
+        {
+            uint32_t size = p.size();
+            outfile.write(reinterpret_cast<const char*>(&size), sizeof(size));
+            outfile.write(p.data(), size);
+        }
+        outfile.write(reinterpret_cast<const char*>(l.slots.data()), 
+            l.slots.size() * sizeof(uint32_t));
+
+        std::vector<char> padding(header.genes_offset - sizeof(Header) - table_size, 0);
+        outfile.write(padding.data(), padding.size());
+        outfile.write(reinterpret_cast<const char*>(l.genes.data()), 
+            l.genes.size() * sizeof(float));
+
+        return (bool)outfile;
+    }
+
+
+    bool load(const std::string& path, Layout& l)
+    {
+        std::ifstream infile(path, std::ios::binary | std::ios::ate);
+        uint64_t file_size = infile ? (uint64_t)infile.tellg() : 0;
+        infile.seekg(0);
+
+        Header header;
+        infile.read(reinterpret_cast<char*>(&header), sizeof(Header));
+
+        if (!infile || std::string(header.magic, 4) != "GALL" || 
+            header.version != VERSION)
+        {
+            std::cout << "Invalid layout file " << path << std::endl;
+            return false;
+        }
+
+        // the tables and genes must fit in the file, so a foreign
+        // header can't make the vectors below huge
+        uint64_t genes_size = (uint64_t)header.n_objs * header.n_genes * 
+            sizeof(float);
+        uint64_t min_table_size = (uint64_t)header.n_paths * sizeof(uint32_t) +
+            (uint64_t)header.n_objs * sizeof(uint32_t);
+        if (header.genes_offset > file_size || 
+            genes_size > file_size - header.genes_offset ||
+            header.paths_offset > file_size ||
+            min_table_size > file_size - header.paths_offset)
+        {
+            std::cout << "Truncated layout file " << path << std::endl;
+            return false;
+        }
+
+        l.n_objs = header.n_objs;
+        l.n_genes = header.n_genes;
+        l.target_size_x = header.target_size_x;
+        l.target_size_y = header.target_size_y;
+        l.scale = header.scale;
+
+        infile.seekg(header.paths_offset);
+        l.paths.resize(header.n_paths);
+        for (auto& p : l.paths)
+        {
+            uint32_t size;
+            if (!infile.read(reinterpret_cast<char*>(&size), sizeof(size)) ||
+                size > file_size)
+            {
+                std::cout << "Truncated layout file " << path << std::endl;
+                return false;
+            }
+            p.resize(size);
+            infile.read(&p[0], size);
+        }
+
+        l.slots.resize(l.n_objs);
+        infile.read(reinterpret_cast<char*>(l.slots.data()), 
+            l.slots.size() * sizeof(uint32_t));
+
+        infile.seekg(header.genes_offset);
+        l.genes.resize(l.n_objs * l.n_genes);
+        infile.read(reinterpret_cast<char*>(l.genes.data()), 
+            l.genes.size() * sizeof(float));
+
+        if (!infile)
+        {
+            std::cout << "Truncated layout file " << path << std::endl;
+            return false;
+        }
+
+        for (uint32_t slot : l.slots)
+        {
+            if (slot >= l.paths.size())
+            {
+                std::cout << "Layout file " << path << " uses object " << 
+                    slot << " of " << l.paths.size() << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <arrayfire.h>
+
+
+/*
+ * Timings and statistics of a single generation.
+ * Times are in milliseconds
+ */
+struct GenerationMetrics
+{
+    int generation = 0;
+    double fitness_ms = 0;
+    double selection_ms = 0;
+    // mutation is fused into the crossover
+    double crossover_ms = 0;
+    double callback_ms = 0;
+    // time spent waiting for the device
+    double sync_ms = 0;
+    size_t device_bytes = 0;
+    float best = 0;
+    float mean = 0;
+    float std = 0;
+    double generations_per_sec = 0;
+};
+
+
+/*
+ * Receives the metrics of each measured generation
+ */
+class MetricsSink
+{
+public:
+    virtual ~MetricsSink() {}
+    virtual void write(const GenerationMetrics& m) = 0;
+};
+
+
+/*
+ * Writes the metrics as comma separated values
+ * with a header line
+ */
+class CsvMetricsSink : public MetricsSink
+{
+public:
+    CsvMetricsSink(const std::string& path) : outfile(path) 
+    {
+        outfile << "generation,fitness_ms,selection_ms,crossover_ms,"
+            "callback_ms,sync_ms,device_bytes,best,mean,std,"
+            "generations_per_sec" << std::endl;
+    }
+
+    void write(const GenerationMetrics& m) override
+    {
+        outfile << m.generation << "," << m.fitness_ms << "," << 
+            m.selection_ms << "," << m.crossover_ms << "," << 
+            m.callback_ms << "," << m.sync_ms << "," << 
+            m.device_bytes << "," << m.best << "," << m.mean << "," << 
+            m.std << "," << m.generations_per_sec << std::endl;
+    }
+
+private:
+    std::ofstream outfile;
+};
+
+
+/*
+ * Writes the metrics as one json object per line
+ */
+class JsonlMetricsSink : public MetricsSink
+{
+public:
+    JsonlMetricsSink(const std::string& path) : outfile(path) {}
+
+    void write(const GenerationMetrics& m) override
+    {
+        outfile << "{\"generation\": " << m.generation << 
+            ", \"fitness_ms\": " << m.fitness_ms << 
+            ", \"selection_ms\": " << m.selection_ms << 
+            ", \"crossover_ms\": " << m.crossover_ms << 
+            ", \"callback_ms\": " << m.callback_ms << 
+            ", \"sync_ms\": " << m.sync_ms << 
+            ", \"device_bytes\": " << m.device_bytes << 
+            ", \"best\": ";
+        number(m.best);
+        outfile << ", \"mean\": ";
+        number(m.mean);
+        outfile << ", \"std\": ";
+        number(m.std);
+        outfile << ", \"generations_per_sec\": " << m.generations_per_sec << 
+            "}" << std::endl;
+    }
+
+private:
+    std::ofstream outfile;
+
+    // json has no nan or inf
+    void number(float value)
+    {
+        if (std::isfinite(value))
+            outfile << value;
+        else
+            outfile << "null";
+    }
+};
+
+
+namespace metrics
+{
+    /*
+     * Waits for the device and returns the milliseconds since
+     * the timer started, restarting it. The wait is added to
+     * the sync time
+     */
+    double lap(af::timer& t, GenerationMetrics& m)
+    {
+        double queued = af::timer::stop(t);
+        af::sync();
+        double elapsed = af::timer::stop(t);
+        m.sync_ms += 1000 * (elapsed - queued);
+        t = af::timer::start();
+        return 1000 * elapsed;
+    }
+
+
+    /*
+     * Returns the bytes the device has in use
+     */
+    size_t device_bytes()
+    {
+        size_t alloc_bytes;
+        size_t alloc_buffers;
+        size_t lock_bytes;
+        size_t lock_buffers;
+        af::deviceMemInfo(&alloc_bytes, &alloc_buffers, 
+            &lock_bytes, &lock_buffers);
+        return lock_bytes;
+    }
+
+
+    /*
+     * Picks the sink from the file extension, csv
+     * or anything else for jsonl
+     */
+    MetricsSink* make_sink(const std::string& path)
+    {
+        if (path.size() >= 4 && path.substr(path.size() - 4) == ".csv")
+            return new CsvMetricsSink(path);
+        return new JsonlMetricsSink(path);
+    }
+}
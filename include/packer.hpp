@@ -1,5 +1,8 @@
 #pragma once
 
+#include <map>
+#include <cmath>
+#include <memory>
 #include <regex>
 #include <random>
 #include <vector>
@@ -10,7 +13,13 @@
 #include <arrayfire.h>
 
 #include "image_functions.hpp"
+#include "sprite_atlas.hpp"
 #include "genetic_algorithm.hpp"
+#include "island_model.hpp"
+#include "checkpoint.hpp"
+#include "layout.hpp"
+#include "frame_writer.hpp"
+#include "asset_cache.hpp"
 
 
 /*
@@ -20,9 +29,28 @@
 class Packer : public Score
 {
 public:
+    /*
+     * The objects are decoded in parallel. If cache_path is
+     * set, the resized objects are kept in that pack file
+     * for the next runs (see asset_cache.hpp)
+     */
     Packer(const char* target_path,
         std::vector<std::string> objs_path,
-        float scale);
+        float scale, std::string cache_path="");
+    /*
+     * Packer with an empty target of the given size,
+     * used to render saved layouts
+     */
+    Packer(int size_x, int size_y,
+        std::vector<std::string> objs_path,
+        float scale, std::string cache_path="");
+    /*
+     * Packer for a target and objects already in memory,
+     * all within the range of 0-1. objs_path names the
+     * objects in saved layouts
+     */
+    Packer(af::array target, std::vector<af::array> objs,
+        float scale, std::vector<std::string> objs_path={});
     ~Packer();
 
     const af::array fitness_func(af::array coords) override;
@@ -30,11 +58,13 @@ public:
 
     /*
      * Runs the algorithm and returns the best
-     * solution.
+     * solution. If resume is set it continues
+     * from the last checkpoint
      */
     af::array run(int pop_size, int max_objs, 
         float mutation_rate, int iters=100, 
-        bool show_cost=false, bool cb=false);
+        bool show_cost=false, bool cb=false,
+        bool resume=false);
     const void save(const char* save_name);
     /*
     * Saves the given array elements into a txt file.
@@ -42,28 +72,175 @@ public:
     * while the others are the content of the array
     */
     const void save_array(af::array arr, const char* filename="out.txt");
+    const void save_array(af::array arr, std::ostream& outfile);
+    /*
+     * Saves the given genes and the objects they use
+     * into a binary layout file (see layout.hpp)
+     */
+    const void save_layout(af::array arr, const char* filename="out.gal");
+    /*
+     * Renders a saved layout. The packer must have been
+     * created with the layout paths
+     */
+    af::array replay(const layout::Layout& l);
+    /*
+     * Metainfo is a Nx5 array containing:
+     * (x,y,scale,obj_index,angle), all within the range of 0-1
+     */
+    af::array make_image(af::array coords) const;
+    af::array make_image_bw(af::array coords) const;
+    /*
+     * Fills each slot with the object of the given
+     * index in the object store. run fills them at
+     * random, fitness_func needs them filled
+     */
+    void load_slots(const std::vector<int>& slots);
 
     // cost function weights
     float area_weight = 800;
     float out_weight = 50;
 
+    // number of angles and scales each object is
+    // pre-rendered at when drawing the final images
+    int angle_steps = 16;
+    int scale_steps = 8;
+
+    // how the genetic algorithm picks mates
+    std::shared_ptr<SelectionStrategy> selection_strategy = 
+        std::make_shared<BestSelection>();
+
+    // number of populations evolved at the same time
+    // and how often they exchange individuals
+    int islands = 1;
+    int migration_interval = 20;
+
+    // if set, the algorithm state is saved to this
+    // file every checkpoint_interval generations
+    std::string checkpoint_path;
+    int checkpoint_interval = 50;
+
+    // format the population is kept in between generations
+    precision::Storage gene_storage = precision::F32;
+
+    // optional, receives per generation timings.
+    // Not used with islands
+    MetricsSink* metrics = nullptr;
+
+    // reuse the coverage of the previous generation and only
+    // redraw the objects whose genes changed. If more than
+    // incremental_threshold of the objects changed everything
+    // is redrawn. Crossover usually changes most objects, so
+    // it only pays off with low mutation and a crossover
+    // that keeps most genes. Not used with islands
+    bool incremental = false;
+    float incremental_threshold = 0.2f;
+
+    // if set, the object bounding boxes of each individual
+    // are binned into a grid_cells x grid_cells grid. The
+    // target left outside every box bounds the area cost
+    // from below, and the boxes stacked over the cells
+    // outside the target estimate the overlap cost. The
+    // prune_keep fraction with the lowest estimates is drawn
+    // first and individuals whose estimate is worse than all
+    // of them are scored with it. The drawn individuals are
+    // rasterized over every cell any of them touches, which
+    // is most of the canvas for spread out populations.
+    // Replaces incremental
+    int grid_cells = 0;
+    float prune_keep = 0.5f;
+
+    // optional, adapts the mutation rate and stops once the
+    // best score stops improving. Not used with islands
+    std::shared_ptr<ConvergenceController> convergence;
+
+    // saves the callback frames, one writing png
+    // files is created if not set
+    std::shared_ptr<FrameWriter> frame_writer;
+
 private:
     /*
-     * Metainfo is a Nx5 array containing:
-     * (x,y,scale,obj_index,angle), all within the range of 0-1
+     * Rasterizes the black and white images of every
+     * individual at once. coords is (pop_size, max_objs, 4)
+     * and the result is a (W, H, pop_size) coverage volume
      */
-    af::array make_image(af::array coords) const;
-    af::array make_image_bw(af::array coords) const;
+    af::array make_population_bw(af::array coords) const;
+    /*
+     * Same as above but only for the canvas pixels at
+     * (px, py), both (n_pixels, 1). Returns (n_pixels, pop_size)
+     */
+    af::array make_population_bw(af::array coords, 
+        af::array px, af::array py) const;
+    /*
+     * Counts the object bounding boxes over each grid cell,
+     * returns (grid_cells, grid_cells, pop_size)
+     */
+    af::array grid_counts(af::array coords) const;
+    /*
+     * Fitness using grid_cells to skip individuals and
+     * empty cells, see grid_cells
+     */
+    af::array grid_fitness(af::array coords);
+    /*
+     * Weighted costs of the given individuals drawing only
+     * the cells where touched, (grid_cells, grid_cells, n),
+     * is set for any of them. Returns (n, 1)
+     */
+    af::array grid_costs(af::array coords, af::array touched) const;
+    /*
+     * Adds (sign 1) or removes (sign -1) the object in slot i
+     * from the cached coverage of the individuals in rows,
+     * updating their area and out costs. genes is (n, 1, 4)
+     */
+    void update_coverage(int i, const af::array& rows, 
+        const af::array& genes, float sign);
+    /*
+     * Converts the target into the normalized
+     * grayscale image the packer fills
+     */
+    void set_target(af::array target);
+    /*
+     * Loads and resizes the object images
+     */
+    void load_objects(const std::vector<std::string>& objs_path,
+        const std::string& cache_path);
+    /*
+     * Packs the resized objects into the object store
+     */
+    void set_objects(const std::vector<af::array>& objs);
+    /*
+     * Returns object k of the store without its padding
+     */
+    af::array get_object(int k) const;
     
     std::vector<std::string> image_paths; // Path to the images used
     std::vector<std::string> objects_paths; // Path to the images used
     
-    std::vector<af::array> object_set; // make a pure af::array later
-    std::vector<af::array> objects_bw; // make a pure af::array later
-    std::vector<af::array> objects; // make a pure af::array later
+    // every object zero padded to the size of the biggest one
+    // and to the most channels of any object, (max_w, max_h,
+    // channels, n_objects), and its black and white mask,
+    // (max_w, max_h, 1, n_objects). object_w and object_h
+    // are the sizes before padding
+    af::array object_store;
+    af::array object_bw_store;
+    std::vector<int> object_w;
+    std::vector<int> object_h;
+    std::vector<int> slot_objects; // object store index of each slot
+    
+    // pre-rendered objects, indexed like the store and
+    // only built for the objects some slot holds
+    std::vector<SpriteAtlas> object_atlases;
+    std::vector<SpriteAtlas> objects_bw_atlases;
     
     af::array result;
     af::array target_img;
+
+    // the last population evaluated, its coverage with a
+    // spare last row for pixels outside the canvas and its
+    // unweighted costs, used by the incremental fitness
+    af::array cached_coords;
+    af::array coverage;
+    af::array area_costs;
+    af::array out_costs;
     
     float scale; // scale used to resize images
 };
@@ -71,10 +248,38 @@ private:
 
 Packer::Packer(const char* target_path,
     std::vector<std::string> objs_path,
-    float scale) : scale(scale)
+    float scale, std::string cache_path) : scale(scale)
+{
+    set_target(af::loadImage(target_path, 1) / 255.f);
+    load_objects(objs_path, cache_path);
+}
+
+
+Packer::Packer(int size_x, int size_y,
+    std::vector<std::string> objs_path,
+    float scale, std::string cache_path) : scale(scale)
+{
+    target_img = af::constant(0, size_x, size_y);
+    load_objects(objs_path, cache_path);
+}
+
+
+Packer::Packer(af::array target, std::vector<af::array> objs,
+    float scale, std::vector<std::string> objs_path) : scale(scale)
 {
-    af::array _target_img = af::loadImage(target_path, 1) / 255.f;
+    set_target(target);
+    for (int i=0; i<objs.size(); i++)
+    {
+        image_paths.push_back(i < objs_path.size() ? 
+            objs_path[i] : "object_" + std::to_string(i));
+        objs[i] = af::resize(scale, objs[i], AF_INTERP_BILINEAR);
+    }
+    set_objects(objs);
+}
+
 
+void Packer::set_target(af::array _target_img)
+{
     // we do this so that the rgb img takes alpha into account
     if (_target_img.dims(2) == 4)
         _target_img = _target_img(af::span, af::span, af::seq(3)) *
@@ -83,17 +288,64 @@ Packer::Packer(const char* target_path,
     target_img = af::rgb2gray(_target_img);
     // normalize values
     target_img /= af::max<float>(target_img);
+}
 
+
+void Packer::load_objects(const std::vector<std::string>& objs_path,
+    const std::string& cache_path)
+{
     image_paths = objs_path;
-    // load img objects
-    for (std::string& obj_path : objs_path)
+    // resized to hold less stuff
+    set_objects(asset_cache::load(objs_path, scale, cache_path));
+}
+
+
+void Packer::set_objects(const std::vector<af::array>& objs)
+{
+    object_w.clear();
+    object_h.clear();
+    int max_w = 1;
+    int max_h = 1;
+    int channels = 1;
+    for (const af::array& obj : objs)
     {
-        std::cout << "Loaded image " << obj_path << std::endl;
-        af::array _img = af::loadImage(obj_path.c_str(), 1) / 255.f;
-         // resize just to hold less stuff
-        af::array _res_img = af::resize(scale, _img, AF_INTERP_BILINEAR);
-        object_set.push_back(_res_img);
+        object_w.push_back(obj.dims(0));
+        object_h.push_back(obj.dims(1));
+        max_w = std::max(max_w, object_w.back());
+        max_h = std::max(max_h, object_h.back());
+        channels = std::max(channels, (int)obj.dims(2));
+    }
+
+    object_store = af::constant(0, max_w, max_h, channels, objs.size());
+    for (int k=0; k<objs.size(); k++)
+    {
+        af::seq sx(object_w[k]);
+        af::seq sy(object_h[k]);
+        int c = objs[k].dims(2);
+        object_store(sx, sy, af::seq(c), k) = objs[k];
+
+        // objects with fewer channels than the store are
+        // gray repeated as color and fully opaque, so they
+        // are drawn like they were before being stored
+        if (c == 1 && channels >= 3)
+            object_store(sx, sy, af::seq(1, 2), k) = 
+                af::tile(objs[k], 1, 1, 2);
+        if (c < 4 && channels == 4)
+            object_store(sx, sy, 3, k) = 1.0f;
     }
+
+    object_bw_store = (object_store(af::span, af::span, 0, af::span) 
+        > 0.01).as(f32);
+
+    object_atlases = std::vector<SpriteAtlas>(objs.size());
+    objects_bw_atlases = std::vector<SpriteAtlas>(objs.size());
+}
+
+
+af::array Packer::get_object(int k) const
+{
+    return object_store(af::seq(object_w[k]), af::seq(object_h[k]), 
+        af::span, k);
 }
 
 
@@ -103,32 +355,134 @@ Packer::~Packer()
 }
 
 
+void Packer::load_slots(const std::vector<int>& slots)
+{
+    slot_objects = slots;
+    objects_paths.clear();
+
+    // slots holding the same object share it, so
+    // repeated objects only get rendered once
+    std::vector<bool> rendered(object_w.size(), false);
+    for (int r : slots)
+    {
+        objects_paths.push_back(image_paths[r]);
+        if (rendered[r])
+            continue;
+        rendered[r] = true;
+
+        af::array obj = get_object(r);
+        object_atlases[r] = SpriteAtlas(obj, 
+            angle_steps, scale_steps, 0.3f, 1.0f);
+        objects_bw_atlases[r] = SpriteAtlas((obj(af::span, af::span, 0) 
+            > 0.01).as(f32), 1, scale_steps, 0.3f, 1.0f, AF_INTERP_NEAREST);
+    }
+}
+
+
 af::array Packer::run(int pop_size, int max_objs, 
     float mutation_rate, int iters, bool show_cost,
-    bool cb)
+    bool cb, bool resume)
 {
-    std::random_device dev;
-    std::mt19937 rng(dev());
-    // load random objects from the set into objects
-    for (int i=0; i<max_objs; i++)
+    if (cb && !frame_writer)
+        frame_writer = std::make_shared<FrameWriter>();
+
+    Checkpoint ckpt;
+    std::unique_ptr<Checkpointer> checkpointer;
+    if (!checkpoint_path.empty())
+    {
+        checkpointer = std::make_unique<Checkpointer>(
+            checkpoint_path, checkpoint_interval);
+        resume = resume && checkpointer->load(ckpt);
+    }
+    else
+    {
+        resume = false;
+    }
+
+    // the objects in each slot are part of the
+    // state, so they are restored when resuming
+    std::vector<float> slots(max_objs);
+    if (resume)
+    {
+        // a checkpoint of another run may hold more slots
+        // or objects that are not loaded now
+        af::array saved = ckpt.has("slot_objects") ?
+            ckpt.get_array("slot_objects") : af::array();
+        resume = saved.elements() == max_objs;
+        if (resume)
+            saved.host(slots.data());
+        for (float r : slots)
+            resume = resume && r >= 0 && r < object_w.size();
+        if (!resume)
+            std::cout << "Checkpoint " << checkpoint_path << 
+                " does not match the objects, starting over" << std::endl;
+    }
+    if (!resume)
     {
+        std::random_device dev;
+        std::mt19937 rng(dev());
         std::uniform_int_distribution<std::mt19937::result_type> 
-            dist6(0, object_set.size() - 1);
-        int r = dist6(rng);
-        objects.push_back(object_set[r]);
-        af::array bw_obj = (object_set[r] > 0.01);
-        objects_bw.push_back(bw_obj(af::span, af::span, 0));
-        objects_paths.push_back(image_paths[r]);
-    }    
+            dist6(0, object_w.size() - 1);
+        for (float& r : slots)
+            r = dist6(rng);
+    }
+
+    if (checkpointer)
+        checkpointer->add_state = [&slots](Checkpoint& c)
+        {
+            c.set("slot_objects", af::array(slots.size(), slots.data()));
+        };
+
+    load_slots(std::vector<int>(slots.begin(), slots.end()));
+    cached_coords = af::array();
 
-    GeneticAlgorithm gal(pop_size, max_objs, 4,
-        mutation_rate, iters);
+    if (metrics && islands > 1)
+        std::cout << "Metrics are not recorded with islands" << std::endl;
 
-    gal.run(*this, cb);
-    af::array best = gal.get_best();
+    af::array best;
+    if (islands > 1)
+    {
+        IslandModel gal(islands, pop_size, max_objs, 4,
+            mutation_rate, iters, migration_interval);
+        gal.strategy = selection_strategy;
+        gal.gene_storage = gene_storage;
+
+        gal.run(*this, cb);
+        best = gal.get_best();
+    }
+    else
+    {
+        GeneticAlgorithm gal(pop_size, max_objs, 4,
+            mutation_rate, iters);
+        gal.strategy = selection_strategy;
+        gal.gene_storage = gene_storage;
+        gal.metrics = metrics;
+        gal.checkpointer = checkpointer.get();
+        gal.convergence = convergence.get();
+        if (resume && gal.load_state(ckpt))
+            std::cout << "Resumed from " << checkpoint_path << std::endl;
+
+        gal.run(*this, cb);
+        best = gal.get_best();
+
+        if (convergence)
+            std::cout << "Ran " << convergence->stats.generations << 
+                " generations" << (convergence->stats.stopped_early ? 
+                ", stopped early" : "") << ", final mutation rate " << 
+                convergence->stats.mutation_rate << std::endl;
+    }
 
     result = af::reorder(best, 1, 2, 0);
 
+    // the coverage holds a canvas per individual
+    cached_coords = af::array();
+    coverage = af::array();
+
+    if (checkpointer)
+        checkpointer->wait();
+    if (frame_writer)
+        frame_writer->flush();
+
     if (show_cost)
     {
         af::array img = make_image_bw(result);
@@ -149,23 +503,29 @@ af::array Packer::make_image(af::array metainfo) const
 {
     int img_size_x = target_img.dims(0);
     int img_size_y = target_img.dims(1);
+    int n_objs = metainfo.dims(0);
 
-    // kind of ineficient
-    // it would be better if we could create
-    // all instances of the population 
-    // at the same time
     af::array img = af::constant(0, img_size_x, img_size_y, 4);
 
-    for (int i=0; i<metainfo.dims(0); i++)
+    // genes are read back once for all objects
+    std::vector<float> genes(4 * n_objs);
+    metainfo(af::span, af::seq(4)).host(genes.data());
+
+    for (int i=0; i<n_objs; i++)
     {
-        float scale = af::sum<float>(0.7f * metainfo(i, 2)+0.3);
-        float angle = af::sum<float>(metainfo(i, 3));
-
-        af::array foreground = objects[i];
-        
-        af::array x = metainfo(i, 0);
-        af::array y = metainfo(i, 1);
-        img = ifs::add_imgs(foreground, img, x, y, scale, 1, 1, angle);
+        int k = slot_objects[i];
+        const SpriteAtlas& atlas = object_atlases[k];
+        float scale = atlas.scale(genes[2 * n_objs + i]);
+        af::array foreground = atlas.get(
+            atlas.index(genes[3 * n_objs + i], genes[2 * n_objs + i]));
+
+        // the atlas centers the object in its cell, so shift it
+        // back to where the resized object would start
+        int x = genes[i] * img_size_x + 
+            (scale * object_w[k] - atlas.size()) / 2;
+        int y = genes[n_objs + i] * img_size_y + 
+            (scale * object_h[k] - atlas.size()) / 2;
+        ifs::blend_at(foreground, img, x, y);
     }
     
     return img;
@@ -176,38 +536,97 @@ af::array Packer::make_image_bw(af::array coord) const
 {     
     int img_size_x = target_img.dims(0);
     int img_size_y = target_img.dims(1);
+    int n_objs = coord.dims(0);
     
     af::array bw_img = af::constant(0, img_size_x, img_size_y, 1);
-    af::array bw_target = (target_img > 0.01f);
-
-    for (int i=0; i<coord.dims(0); i++)
-    {
-        af::array foreground = af::resize(
-            af::sum<float>(0.7f * coord(i, 2)+0.3f), objects_bw[i]);;
 
-        int size_x = foreground.dims(0);
-        int size_y = foreground.dims(1);
+    std::vector<float> genes(4 * n_objs);
+    coord(af::span, af::seq(4)).host(genes.data());
 
-        float angle = af::sum<float>(coord(i, 3));
-        af::array _x = coord(i, 0);
-        af::array _y = coord(i, 1);
+    for (int i=0; i<n_objs; i++)
+    {
+        int k = slot_objects[i];
+        const SpriteAtlas& atlas = objects_bw_atlases[k];
+        float scale = atlas.scale(genes[2 * n_objs + i]);
+        af::array foreground = atlas.get(
+            atlas.index(0.0f, genes[2 * n_objs + i]));
 
-        af::array x = af::seq(size_x) + 
-            af::tile(_x * img_size_x, size_x);
-        af::array y = af::seq(size_y) + 
-            af::tile(_y * img_size_y, size_y);
+        int size = atlas.size();
+        int x = genes[i] * img_size_x + 
+            (scale * object_w[k] - size) / 2;
+        int y = genes[n_objs + i] * img_size_y + 
+            (scale * object_h[k] - size) / 2;
 
-        af::array n_img = bw_img;
-        n_img(x, y, af::span, af::span) = 
-            bw_img(x, y, af::span, af::span) + foreground;
+        // clip the object to the image
+        int start_x = std::max(0, -x);
+        int start_y = std::max(0, -y);
+        int end_x = std::min(size, img_size_x - x);
+        int end_y = std::min(size, img_size_y - y);
+        if (end_x <= start_x || end_y <= start_y)
+            continue;
 
-        bw_img = n_img;
+        af::seq img_x(x + start_x, x + end_x - 1);
+        af::seq img_y(y + start_y, y + end_y - 1);
+        bw_img(img_x, img_y) += foreground(
+            af::seq(start_x, end_x - 1), af::seq(start_y, end_y - 1));
     }
     
     return bw_img;
 }
 
 
+af::array Packer::make_population_bw(af::array coords) const
+{
+    int img_size_x = target_img.dims(0);
+    int img_size_y = target_img.dims(1);
+    int pop_size = coords.dims(0);
+
+    af::array bw_imgs = make_population_bw(coords,
+        af::flat(af::range(af::dim4(img_size_x, img_size_y), 0)),
+        af::flat(af::range(af::dim4(img_size_x, img_size_y), 1)));
+
+    return af::moddims(bw_imgs, img_size_x, img_size_y, pop_size);
+}
+
+
+af::array Packer::make_population_bw(af::array coords,
+    af::array px, af::array py) const
+{
+    int img_size_x = target_img.dims(0);
+    int img_size_y = target_img.dims(1);
+    int n_pixels = px.elements();
+    int pop_size = coords.dims(0);
+
+    // canvas pixel coordinates, one column per individual
+    px = af::tile(px, 1, pop_size);
+    py = af::tile(py, 1, pop_size);
+
+    af::array bw_imgs = af::constant(0, n_pixels, pop_size);
+
+    // instead of placing each object on each individual
+    // we map every pixel back into the object frame and
+    // sample it, so there is one kernel per object for
+    // the whole population
+    for (int i=0; i<coords.dims(1); i++)
+    {
+        af::array x = af::tile(
+            coords(af::span, i, 0).T() * img_size_x, n_pixels);
+        af::array y = af::tile(
+            coords(af::span, i, 1).T() * img_size_y, n_pixels);
+        af::array scale = af::tile(
+            0.7f * coords(af::span, i, 2).T() + 0.3f, n_pixels);
+
+        // the padding samples as empty, like outside the object
+        bw_imgs += af::approx2(
+            object_bw_store(af::span, af::span, 0, slot_objects[i]), 
+            (px - x) / scale, (py - y) / scale, 
+            AF_INTERP_NEAREST, 0.0f);
+    }
+
+    return bw_imgs;
+}
+
+
 const void Packer::callback(af::array best, int i) 
 {
     af::array current_img = make_image(af::reorder(best, 1, 2, 0));
@@ -219,10 +638,19 @@ const void Packer::callback(af::array best, int i)
     std::string prefix = "iter_";
     std::string ext = ".png";
     std::string filename = prefix + str + ext;
-    af::saveImageNative(filename.c_str(), mimg);
 
     ext = ".txt";
-    save_array(af::reorder(best, 1, 2, 0), (prefix + str + ext).c_str());
+    if (!frame_writer)
+    {
+        af::saveImageNative(filename.c_str(), mimg);
+        save_array(af::reorder(best, 1, 2, 0), (prefix + str + ext).c_str());
+        return;
+    }
+
+    std::stringstream text;
+    save_array(af::reorder(best, 1, 2, 0), text);
+    frame_writer->write(mimg, filename);
+    frame_writer->write_text(prefix + str + ext, text.str());
 }
 
 
@@ -230,29 +658,303 @@ const void Packer::callback(af::array best, int i)
 const af::array Packer::fitness_func(af::array coords)
 {
     int pop_size = coords.dims(0);
-    af::array costs = af::constant(0, pop_size, f32);
-    
-    for (int j = 0; j < pop_size; j++)
+    int max_objs = coords.dims(1);
+    int n_pixels = target_img.elements();
+
+    // islands evaluate their populations at the same time,
+    // so only a single population may use the shared cache
+    bool cacheable = incremental && islands <= 1;
+
+    if (grid_cells > 0)
+    {
+        if (cacheable)
+            cached_coords = af::array();
+        return grid_fitness(coords);
+    }
+
+    bool use_cache = cacheable && 
+        !cached_coords.isempty() && cached_coords.dims() == coords.dims();
+
+    // (pop_size, max_objs), an object changed if any of its genes did.
+    // Only the count is read back unless the cache is used
+    af::array diff;
+    int n_changed = pop_size * max_objs;
+    if (use_cache)
+    {
+        diff = af::anyTrue(coords != cached_coords, 2);
+        n_changed = af::count<int>(diff);
+    }
+
+    if (!use_cache || n_changed > incremental_threshold * pop_size * max_objs)
     {
-        // make image
-        // kind of ineficient
-        // it would be better if we could create
-        // all instances of the population 
-        // at the same time
-        af::array coord = af::reorder(coords(j, af::span), 1, 2, 0);
-        
-        af::array bw_img = make_image_bw(coord);
-        // af::array bw_target = (target_img > 0.01f);
+        // each column is the flattened image of an individual
+        af::array bw_imgs = af::moddims(
+            make_population_bw(coords), n_pixels, pop_size);
+        af::array target = af::tile(af::flat(target_img), 1, pop_size);
 
         // punish for not filling the inside area 
-        af::array area_cost = area_weight * af::sum(af::sum(target_img * !bw_img));
+        af::array area = af::sum(target * !bw_imgs, 0).T();
         // punish for filling the outside area
-        af::array cost = out_weight * af::sum(af::sum(!target_img * bw_img));
+        af::array out = af::sum(!target * bw_imgs, 0).T();
 
-        costs(j) = cost + area_cost;
+        if (cacheable)
+        {
+            area_costs = area;
+            out_costs = out;
+            coverage = af::join(0, bw_imgs, af::constant(0, 1, pop_size));
+            cached_coords = coords.copy();
+        }
+        return -(out_weight * out + area_weight * area);
     }
-    
-    return -costs;
+
+    if (n_changed > 0)
+    {
+        std::vector<char> changed(pop_size * max_objs);
+        diff.as(u8).host(changed.data());
+
+        // remove the old objects and add the new ones, slot by
+        // slot since objects of the same individual overlap
+        std::vector<unsigned> rows;
+        for (int i=0; i<max_objs; i++)
+        {
+            rows.clear();
+            for (int j=0; j<pop_size; j++)
+                if (changed[i * pop_size + j])
+                    rows.push_back(j);
+            if (rows.empty())
+                continue;
+
+            af::array idx(rows.size(), rows.data());
+            update_coverage(i, idx, cached_coords(idx, i, af::span), -1);
+            update_coverage(i, idx, coords(idx, i, af::span), 1);
+        }
+        cached_coords = coords.copy();
+    }
+
+    return -(out_weight * out_costs + area_weight * area_costs);
+}
+
+
+void Packer::update_coverage(int i, const af::array& rows, 
+    const af::array& genes, float sign)
+{
+    int img_size_x = target_img.dims(0);
+    int img_size_y = target_img.dims(1);
+    int n_pixels = img_size_x * img_size_y;
+    int n = rows.elements();
+
+    // the object is drawn inside a window starting at its
+    // position. Scales are at most 1, but nearest sampling
+    // reaches the last object pixel up to (object_w - 0.5) *
+    // scale past x, which can be object_w pixels past floor(x),
+    // so the window is a pixel bigger than the object
+    int k = slot_objects[i];
+    af::array obj = object_bw_store(af::span, af::span, 0, k);
+    int w = object_w[k] + 1;
+    int h = object_h[k] + 1;
+
+    af::array x = af::tile(af::moddims(
+        genes(af::span, 0, 0), 1, n) * img_size_x, w * h);
+    af::array y = af::tile(af::moddims(
+        genes(af::span, 0, 1), 1, n) * img_size_y, w * h);
+    af::array scale = af::tile(af::moddims(
+        0.7f * genes(af::span, 0, 2) + 0.3f, 1, n), w * h);
+
+    // same sampling as make_population_bw over the window
+    af::array px = af::tile(af::flat(
+        af::range(af::dim4(w, h), 0)), 1, n) + af::floor(x);
+    af::array py = af::tile(af::flat(
+        af::range(af::dim4(w, h), 1)), 1, n) + af::floor(y);
+    af::array vals = af::approx2(obj, (px - x) / scale, (py - y) / scale,
+        AF_INTERP_NEAREST, 0.0f);
+
+    // pixels outside the canvas go to the spare row
+    af::array inside = px >= 0 && px < img_size_x && 
+        py >= 0 && py < img_size_y;
+    vals *= inside;
+    af::array pixel = af::select(inside, 
+        px.as(s32) + py.as(s32) * img_size_x, n_pixels).as(u32);
+    af::array idx = af::flat(pixel + 
+        af::tile(rows.as(u32).T(), w * h) * (unsigned)(n_pixels + 1));
+
+    af::array target = af::moddims(af::lookup(af::join(0, 
+        af::flat(target_img), af::constant(0, 1)), af::flat(pixel)), w * h, n);
+
+    af::array old_cov = af::moddims(coverage(idx), w * h, n);
+    af::array new_cov = old_cov + sign * vals;
+    coverage(idx) = af::flat(new_cov);
+
+    af::array area_delta = af::sum(target * 
+        ((new_cov == 0).as(f32) - (old_cov == 0).as(f32)), 0);
+    af::array out_delta = sign * af::sum(!target * vals, 0);
+
+    area_costs(rows) += area_delta.T();
+    out_costs(rows) += out_delta.T();
+}
+
+
+af::array Packer::grid_counts(af::array coords) const
+{
+    int img_size_x = target_img.dims(0);
+    int img_size_y = target_img.dims(1);
+    int pop_size = coords.dims(0);
+    int max_objs = coords.dims(1);
+    int g = grid_cells;
+    float cell_x = std::ceil((float)img_size_x / g);
+    float cell_y = std::ceil((float)img_size_y / g);
+
+    std::vector<float> sizes(2 * max_objs);
+    for (int i=0; i<max_objs; i++)
+    {
+        sizes[i] = object_w[slot_objects[i]];
+        sizes[max_objs + i] = object_h[slot_objects[i]];
+    }
+    af::array obj_w = af::tile(af::array(1, max_objs, sizes.data()), pop_size);
+    af::array obj_h = af::tile(af::array(1, max_objs, 
+        sizes.data() + max_objs), pop_size);
+
+    // bounding box of each object in cells, (pop_size, max_objs)
+    af::array scale = 0.7f * coords(af::span, af::span, 2) + 0.3f;
+    af::array x = coords(af::span, af::span, 0) * img_size_x;
+    af::array y = coords(af::span, af::span, 1) * img_size_y;
+    // with a pixel of margin for the nearest sampling
+    af::array x0 = af::floor(af::max(x - 1, 0) / cell_x);
+    af::array y0 = af::floor(af::max(y - 1, 0) / cell_y);
+    af::array x1 = af::floor(af::min(x + scale * obj_w + 1, 
+        img_size_x - 1) / cell_x);
+    af::array y1 = af::floor(af::min(y + scale * obj_h + 1, 
+        img_size_y - 1) / cell_y);
+    af::array valid = (x1 >= x0) && (y1 >= y0);
+
+    // the boxes are added as the corners of a difference
+    // grid, with one extra bin for the objects out of frame
+    int stride = (g + 1) * (g + 1);
+    int bins = pop_size * stride + 1;
+    af::array offset = af::tile(af::range(pop_size) * stride, 1, max_objs);
+    auto corners = [&](af::array cx, af::array cy)
+    {
+        af::array idx = af::select(valid, 
+            cx + cy * (g + 1) + offset, (double)(bins - 1));
+        return af::histogram(af::flat(idx), bins, 0, bins).as(f32);
+    };
+    af::array diff = corners(x0, y0) - corners(x1 + 1, y0) - 
+        corners(x0, y1 + 1) + corners(x1 + 1, y1 + 1);
+
+    af::array counts = af::moddims(diff(af::seq(bins - 1)), g + 1, g + 1, pop_size);
+    counts = af::accum(af::accum(counts, 0), 1);
+    return counts(af::seq(g), af::seq(g), af::span);
+}
+
+
+af::array Packer::grid_fitness(af::array coords)
+{
+    int img_size_x = target_img.dims(0);
+    int img_size_y = target_img.dims(1);
+    int pop_size = coords.dims(0);
+    int g = grid_cells;
+    int cell_x = (img_size_x + g - 1) / g;
+    int cell_y = (img_size_y + g - 1) / g;
+
+    af::array counts = grid_counts(coords);
+    af::array touched = counts > 0;
+
+    // sums the image over each cell
+    auto cell_sums = [&](const af::array& img)
+    {
+        af::array padded = af::constant(0, g * cell_x, g * cell_y);
+        padded(af::seq(img_size_x), af::seq(img_size_y)) = img;
+        return af::moddims(af::sum(af::sum(
+            af::moddims(padded, cell_x, g, cell_y, g), 0), 2), g, g);
+    };
+    // target mass and pixels outside the target of each cell
+    af::array mass = cell_sums(target_img);
+    af::array empty = cell_sums((target_img == 0).as(f32));
+
+    // share of its box an object covers, on average
+    af::array opaque = af::flat(af::sum(af::sum(object_bw_store, 0), 1));
+    std::vector<float> opaque_px(opaque.elements());
+    opaque.host(opaque_px.data());
+    float fill = 0;
+    for (int k : slot_objects)
+        fill += opaque_px[k] / (object_w[k] * object_h[k]);
+    fill /= std::max(1, (int)slot_objects.size());
+
+    // the target outside every box is never covered and every
+    // box stacked over a cell covers its empty pixels again
+    af::array area_bound = af::sum(af::sum(
+        af::tile(mass, 1, 1, pop_size) * !touched, 0), 1);
+    af::array overlap = af::sum(af::sum(af::tile(empty, 1, 1, pop_size) * 
+        af::max(counts - 1, 0.0), 0), 1);
+    af::array bounds = af::flat(area_weight * area_bound + 
+        out_weight * fill * overlap);
+    std::vector<float> bound(pop_size);
+    bounds.host(bound.data());
+
+    std::vector<int> order(pop_size);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+        [&bound](int a, int b) { return bound[a] < bound[b]; });
+
+    std::vector<float> costs(bound);
+    auto draw = [&](int begin, int end)
+    {
+        if (end <= begin)
+            return 0.0f;
+        std::vector<unsigned> rows(order.begin() + begin, order.begin() + end);
+        af::array idx(rows.size(), rows.data());
+        std::vector<float> c(rows.size());
+        grid_costs(coords(idx, af::span, af::span), 
+            touched(af::span, af::span, idx)).host(c.data());
+        for (int i=0; i<rows.size(); i++)
+            costs[rows[i]] = c[i];
+        return *std::max_element(c.begin(), c.end());
+    };
+
+    int keep = std::max(1, (int)std::ceil(prune_keep * pop_size));
+    float worst = draw(0, std::min(keep, pop_size));
+
+    // the ones that could still beat the worst drawn
+    // individual are drawn too, the rest keep their bound
+    int n = keep;
+    while (n < pop_size && bound[order[n]] < worst)
+        n++;
+    draw(keep, n);
+
+    return -af::array(pop_size, costs.data());
+}
+
+
+af::array Packer::grid_costs(af::array coords, af::array touched) const
+{
+    int img_size_x = target_img.dims(0);
+    int img_size_y = target_img.dims(1);
+    int g = grid_cells;
+    int cell_x = (img_size_x + g - 1) / g;
+    int cell_y = (img_size_y + g - 1) / g;
+
+    // pixels of the cells touched by any individual. Drawing
+    // each individual over only its own cells would take a
+    // kernel per object and individual
+    af::array cells = af::flat(af::anyTrue(touched, 2));
+    af::array px = af::flat(af::range(af::dim4(img_size_x, img_size_y), 0));
+    af::array py = af::flat(af::range(af::dim4(img_size_x, img_size_y), 1));
+    af::array cell = (af::floor(px / cell_x) + 
+        af::floor(py / cell_y) * g).as(u32);
+    af::array active = af::where(af::lookup(cells, cell));
+
+    af::array target = af::flat(target_img);
+    // nothing covers the other pixels
+    float idle_mass = af::sum<float>(target) - 
+        (active.elements() ? af::sum<float>(target(active)) : 0.0f);
+    if (active.elements() == 0)
+        return af::constant(area_weight * idle_mass, coords.dims(0));
+
+    af::array bw_imgs = make_population_bw(coords, px(active), py(active));
+    target = af::tile(target(active), 1, coords.dims(0));
+
+    af::array area_cost = af::sum(target * !bw_imgs, 0) + idle_mass;
+    af::array out_cost = af::sum(!target * bw_imgs, 0);
+    return (area_weight * area_cost + out_weight * out_cost).T();
 }
 
 
@@ -265,13 +967,21 @@ const void Packer::save(const char* save_name)
 
     std::string arr_name = std::regex_replace(save_name, std::regex(".png"), ".txt");
     save_array(result, arr_name.c_str());
+
+    std::string layout_name = std::regex_replace(save_name, std::regex(".png"), ".gal");
+    save_layout(result, layout_name.c_str());
 }
 
 
 const void Packer::save_array(af::array arr, const char* filename)
 {
     std::ofstream outfile(filename);
+    save_array(arr, outfile);
+}
+
 
+const void Packer::save_array(af::array arr, std::ostream& outfile)
+{
     auto add_to_file = [&outfile](std::string title, auto data, auto to_write) {
         outfile << title << ":" << std::endl;
         to_write(data, outfile);
@@ -279,29 +989,29 @@ const void Packer::save_array(af::array arr, const char* filename)
     };
 
     // metadata
-    add_to_file("dna_dims", arr, [](af::array arr, std::ofstream& outfile){
+    add_to_file("dna_dims", arr, [](af::array arr, std::ostream& outfile){
         outfile << "\t" << arr.dims() << std::endl;
     });
     
     // image original dims
     add_to_file("target_img_dims", target_img, 
-        [](af::array target_img, std::ofstream& outfile){
+        [](af::array target_img, std::ostream& outfile){
             outfile << "\t" << target_img.dims() << std::endl;
         });
 
     // images rescale
-    add_to_file("scale", scale, [](float scale, std::ofstream& outfile){
+    add_to_file("scale", scale, [](float scale, std::ostream& outfile){
         outfile << "\t" << scale << std::endl;
     });
     
     // image files
-    add_to_file("objs_path", objects_paths, [](auto objects_paths, std::ofstream& outfile){
+    add_to_file("objs_path", objects_paths, [](auto objects_paths, std::ostream& outfile){
         for (auto &obj_path : objects_paths)
             outfile << "\t" << obj_path << std::endl;
     });
 
     // data
-    add_to_file("genes", arr, [](af::array arr, std::ofstream& outfile){
+    add_to_file("genes", arr, [](af::array arr, std::ostream& outfile){
         float *genes = arr.host<float>();
         for(int i = 0; i < arr.elements(); i++) 
         {
@@ -312,3 +1022,39 @@ const void Packer::save_array(af::array arr, const char* filename)
         af::freeHost(genes);
     });
 }
+
+
+const void Packer::save_layout(af::array arr, const char* filename)
+{
+    layout::Layout l;
+    l.target_size_x = target_img.dims(0);
+    l.target_size_y = target_img.dims(1);
+    l.scale = scale;
+    l.n_objs = arr.dims(0);
+    l.n_genes = arr.dims(1);
+
+    // only the objects in use are saved
+    std::map<int, uint32_t> path_idx;
+    for (int r : slot_objects)
+    {
+        if (path_idx.count(r) == 0)
+        {
+            path_idx[r] = l.paths.size();
+            l.paths.push_back(image_paths[r]);
+        }
+        l.slots.push_back(path_idx[r]);
+    }
+
+    l.genes.resize(arr.elements());
+    arr.as(f32).host(l.genes.data());
+
+    layout::save(filename, l);
+}
+
+
+af::array Packer::replay(const layout::Layout& l)
+{
+    load_slots(std::vector<int>(l.slots.begin(), l.slots.end()));
+    result = af::array(l.n_objs, l.n_genes, l.genes.data());
+    return make_image(result);
+}
@@ -1,13 +1,24 @@
 #pragma once
 
+#include <cmath>
 #include <string>
+#include <vector>
 #include <random>
 #include <chrono>
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <thread>
 #include <iostream>
 #include <arrayfire.h>
 
 #include "image_functions.hpp"
+#include "sprite_atlas.hpp"
 #include "genetic_algorithm.hpp"
+#include "island_model.hpp"
+#include "checkpoint.hpp"
+#include "precision.hpp"
+#include "frame_writer.hpp"
 
 
 class Painter : public Score
@@ -15,11 +26,85 @@ class Painter : public Score
 public:
     float var_weights = 1.0f;
     float grad_weights = 1.0f;
+    /*
+     * Mip level the fitness function samples from. Level 0
+     * is the full resolution image, each level halves it
+     */
+    int fitness_level = 0;
+    /*
+     * Number of precomputed brush rotations. Stroke angles
+     * are rounded to the closest one
+     */
+    int rotation_steps = 32;
+    /*
+     * Number of populations evolved at the same time
+     * and how often they exchange individuals
+     */
+    int islands = 1;
+    int migration_interval = 20;
+    /*
+     * If set, each loop splits the canvas into tiles of
+     * focus_tile_size pixels and only paints the focus_tiles
+     * ones with the highest summed weights, each with its own
+     * genetic algorithm. The loop strokes are split between
+     * them and focus_concurrent runs them on parallel threads
+     */
+    int focus_tiles = 0;
+    int focus_tile_size = 128;
+    bool focus_concurrent = false;
+    /*
+     * Mutation rate each loop starts with. If convergence
+     * is set it adapts the rate and ends a loop once its
+     * best score stops improving. Not used with islands
+     * or focus_tiles
+     */
+    float mutation_rate = 0.001f;
+    std::shared_ptr<ConvergenceController> convergence;
+    /*
+     * If set, the painting state is saved to this file after
+     * every loop and every checkpoint_interval generations
+     */
+    std::string checkpoint_path;
+    int checkpoint_interval = 50;
+    /*
+     * Number of image pyramid levels. The loops are split
+     * between them, the first ones paint a downsampled
+     * target and the canvas is upsampled between levels.
+     * level_strokes sets the strokes of each level, coarse
+     * first, and defaults to dna_size_x. There are never
+     * more levels than loops
+     */
+    int pyramid_levels = 1;
+    std::vector<int> level_strokes;
+    /*
+     * Formats the population and the canvas are kept in
+     * between steps. Everything is computed in f32
+     */
+    precision::Storage gene_storage = precision::F32;
+    precision::Storage canvas_storage = precision::F32;
+    /*
+     * Optional, receives per generation timings.
+     * Not used with islands or focus_tiles
+     */
+    MetricsSink* metrics = nullptr;
+    /*
+     * Saves the progress frames when running with save.
+     * One writing png files is created if not set
+     */
+    std::shared_ptr<FrameWriter> frame_writer;
 
     Painter(const char *img_path, const char *brush_path,
         float brush_scale, int iters, int dna_size_x, 
         int dna_size_y, int loops=10, int pop_size=100,
         float var_weights=1.0f, float grad_weights=1.0f);
+    /*
+     * Paints an image already in memory. Both arrays
+     * must be within the range of 0-1
+     */
+    Painter(af::array target_image, af::array brush,
+        float brush_scale, int iters, int dna_size_x, 
+        int dna_size_y, int loops=10, int pop_size=100,
+        float var_weights=1.0f, float grad_weights=1.0f);
     ~Painter();
 
     /*
@@ -29,9 +114,19 @@ public:
     const af::array fitness_func(af::array coords) override;
     /*
      * Paints the image using parts of the it and then merges it
-     * together
+     * together. If resume is set it continues from the last
+     * checkpoint
      */
-    void run(bool save=false);
+    void run(bool save=false, bool resume=false);
+
+    /*
+     * Metainfo is a Nx3 array containing:
+     * (x,y,angle) all within the range of 0-1
+     */
+    af::array make_image(af::array metainfo, 
+        bool save=false, int* frame_n=0, bool rotate=false) const;    
+    af::array make_image(af::array metainfo, af::array img,
+        bool save=false, int* frame_n=0, bool rotate=false) const;
 
     af::array get_target_img() const;
     af::array get_current_img() const;
@@ -47,29 +142,121 @@ private:
 
     af::array target_image;
     af::array brush;
+    /*
+     * Full resolution target, gradient and brush, the ones
+     * above are downsampled from them for the pyramid level
+     */
+    af::array base_target;
+    af::array base_gradient;
+    af::array full_brush;
+    int level = -1;
+    /*
+     * The brush rotated by each of the quantized angles
+     */
+    SpriteAtlas brush_atlas;
     af::array results;
     af::array c_weights;
     af::array current_img;
     af::array img_gradient;
 
     /*
-     * Metainfo is a Nx4 array containing:
-     * (x,y,color,angle) all within the range of 0-1
+     * Maps derived from c_weights and img_gradient used by the
+     * fitness function. Index i holds the mip level i. They are
+     * only rebuilt when the weights change
      */
-    af::array make_image(af::array metainfo, 
-        bool save=false, int* frame_n=0, bool rotate=false) const;    
-    af::array make_image(af::array metainfo, af::array img,
-        bool save=false, int* frame_n=0, bool rotate=false) const;
+    std::vector<af::array> inv_weights_mips;
+    std::vector<af::array> gradient_mips;
 
     /*
      * Calculates which parts of the image the genetic
      * algorithm should focus on
      */
     af::array calculate_weights(af::array c_img) const;
+    /*
+     * Recalculates the weights for the given image and
+     * refreshes the maps the fitness function samples
+     */
+    void update_weights(af::array c_img);
+    /*
+     * Rebuilds the maps the fitness function samples
+     * from the current weights
+     */
+    void refresh_weight_maps();
+    /*
+     * Saves the canvas, weights, brush size, frame and
+     * loop index into the checkpoint
+     */
+    void save_state(Checkpoint& ckpt, int loop, int frame_n) const;
+    /*
+     * Restores the state saved by save_state and
+     * returns the loop index
+     */
+    int load_state(const Checkpoint& ckpt, int* frame_n);
+    /*
+     * Switches the target, gradient, brush and canvas
+     * to the given pyramid level
+     */
+    void set_level(int level);
+    /*
+     * Downsamples the full brush to the current level
+     */
+    void update_brush();
+    /*
+     * Renders the brush at every quantized angle. Must be
+     * called whenever the brush changes
+     */
+    void build_brush_atlas();
+    /*
+     * Paints the tiles with the highest weights, see
+     * focus_tiles. Returns the best strokes of every
+     * tile in canvas coordinates
+     */
+    af::array run_focused(int strokes, float mutation_rate);
+
+    /*
+     * Scores strokes inside a tile. Their x and y genes
+     * are tile coordinates, mapped to the canvas before
+     * calling the painter fitness function
+     */
+    class TileScore : public Score
+    {
+    public:
+        TileScore(Painter& painter, float x0, float y0, float w, float h) :
+            painter(painter), x0(x0), y0(y0), w(w), h(h) {}
+
+        const af::array fitness_func(af::array coords) override
+        {
+            return painter.fitness_func(to_canvas(coords));
+        }
+
+        af::array to_canvas(af::array coords) const
+        {
+            return af::join(2, x0 + w * coords(af::span, af::span, 0),
+                y0 + h * coords(af::span, af::span, 1),
+                coords(af::span, af::span, af::seq(2, af::end)));
+        }
+
+    private:
+        Painter& painter;
+        float x0, y0, w, h;
+    };
 };
 
 
 Painter::Painter(const char *img_path, const char *brush_path,
+    float brush_scale, int iters, int dna_size_x,
+    int dna_size_y, int loops, int pop_size, 
+    float var_weights, float grad_weights) : 
+        Painter(af::loadImage(img_path, 1) / 255.f,
+            af::loadImage(brush_path, true) / 255.f,
+            brush_scale, iters, dna_size_x, dna_size_y,
+            loops, pop_size, var_weights, grad_weights)
+{
+
+}
+
+
+Painter::Painter(af::array _target_image, af::array _brush,
     float brush_scale, int iters, int dna_size_x,
     int dna_size_y, int loops, int pop_size, 
     float var_weights, float grad_weights) : 
@@ -79,8 +266,7 @@ Painter::Painter(const char *img_path, const char *brush_path,
         grad_weights(grad_weights)
 {
     // downsample
-    target_image = af::loadImage(img_path, 1) / 255.f;
-    target_image = af::medfilt2(target_image, 5, 5);
+    target_image = af::medfilt2(_target_image, 5, 5);
 
     // image edges gradient
     af::array target_gray = af::rgb2gray(target_image);
@@ -90,18 +276,23 @@ Painter::Painter(const char *img_path, const char *brush_path,
     img_gradient = af::abs(af::atan2(dy, dx));
 
     // load brush image
-    brush = af::loadImage(brush_path, true) / 255.f;
+    brush = _brush;
     brush(af::span, af::span, af::seq(3)) += 0.f;
     brush = af::medfilt2(brush, 5, 5);
     
     brush = af::resize(brush_scale, brush);
+    build_brush_atlas();
+
+    base_target = target_image;
+    base_gradient = img_gradient;
+    full_brush = brush;
     std::cout << "brush dims " << brush.dims() << std::endl;
     std::cout << "target image " << target_image.dims() << std::endl;
 
     // weights calc
     current_img = af::constant(0, target_image.dims(0), 
         target_image.dims(1), 4, 1, f32);
-    c_weights = calculate_weights(current_img);
+    update_weights(current_img);
 }
 
 
@@ -125,42 +316,55 @@ af::array Painter::make_image(af::array metainfo,
     af::array img, bool save, 
     int* frame_n, bool rotate) const
 {
-    int img_size_x = target_image.dims(0);
-    int img_size_y =  target_image.dims(1);
-
-    for (int n=0; n<img_size_x; n++)
+    int img_size_x = img.dims(0);
+    int img_size_y = img.dims(1);
+    int n_strokes = metainfo.dims(0);
+
+    int size_x = brush_atlas.size();
+    int size_y = brush_atlas.size();
+
+    // pick the rotated brush of every stroke from the atlas,
+    // the middle angle is the unrotated brush
+    af::array angles = rotate ? metainfo(af::span, 2) :
+        af::constant(0.5f, n_strokes);
+    af::array strokes = brush_atlas.get(
+        brush_atlas.index(angles, af::constant(0, n_strokes)));
+
+    // apply the target color under the middle of each stroke
+    af::array mid_x = af::clamp(af::floor(metainfo(af::span, 0) * img_size_x) + 
+        size_x / 2, 0, img_size_x - 1);
+    af::array mid_y = af::clamp(af::floor(metainfo(af::span, 1) * img_size_y) + 
+        size_y / 2, 0, img_size_y - 1);
+    af::array colors = af::moddims(target_image, img_size_x * img_size_y, 3)(
+        (mid_x + mid_y * img_size_x).as(u32), af::span);
+    strokes(af::span, af::span, af::seq(3), af::span) *= af::tile(
+        af::moddims(colors.T(), 1, 1, 3, n_strokes), size_x, size_y);
+
+    // positions are the only thing needed on the host
+    // so they are read back once for all strokes
+    std::vector<float> pos(2 * n_strokes);
+    metainfo(af::span, af::seq(2)).host(pos.data());
+
+    // strokes must be blended in order, but all that is
+    // left for each one is a single index and blend
+    for (int n=0; n<n_strokes; n++)
     { 
-        af::array mbrush = brush;
-
-        float angle = af::sum<float>(metainfo(n, 2));
-        af::array x = metainfo(n, 0);
-        af::array y = metainfo(n, 1);
-
-        af::array _target_img = target_image;
-
-        img = ifs::add_imgs(mbrush, img, x, y, 0, 0, 1, angle,
-            [&_target_img](af::array mbrush, af::array _1, af::array x, af::array y, af::array _2)
-            {
-                int size_x = mbrush.dims(0);
-                int size_y = mbrush.dims(1);
+        int x = pos[n] * img_size_x;
+        int y = pos[n_strokes + n] * img_size_y;
 
-                af::array mid_x = x(size_x/2);
-                af::array mid_y = y(size_y/2);
-
-                // apply color
-                mbrush(af::span, af::span, af::seq(3), af::span) *= 
-                    af::tile(_target_img(mid_x, mid_y, af::seq(3)), size_x, size_y);
-                return mbrush;
-            });
+        ifs::blend_at(strokes(af::span, af::span, af::span, n), img, x, y);
 
         if (save && (
-            n == img_size_x - 1 || n % 50 == 0))
+            n == n_strokes - 1 || n % 50 == 0))
         {
             af::array mimg = (img * 255).as(u8);
             mimg = af::resize(0.5f, mimg);
             std::string filename = "../imgs/process/" + 
-                std::to_string(*frame_n++) + ".png";
-            af::saveImageNative(filename.c_str(), mimg);
+                std::to_string((*frame_n)++) + ".png";
+            if (frame_writer)
+                frame_writer->write(mimg, filename);
+            else
+                af::saveImageNative(filename.c_str(), mimg);
         }
     }
     
@@ -170,36 +374,32 @@ af::array Painter::make_image(af::array metainfo,
 
 const af::array Painter::fitness_func(af::array coords)
 {
-    // coords is pop_size x dna_size_x x 4 x 1
-    af::array x = coords(af::span, af::span, 0) * target_image.dims(0);
-    af::array y = coords(af::span, af::span, 1) * target_image.dims(1);
+    // coords is pop_size x dna_size_x x 3 x 1
+    const af::array& inv_weights = inv_weights_mips.back();
+    const af::array& gradient = gradient_mips.back();
 
-    af::array grad = 2 * ifs::PI * coords(af::span, af::span, 2) - ifs::PI;
+    af::array x = coords(af::span, af::span, 0) * inv_weights.dims(0);
+    af::array y = coords(af::span, af::span, 1) * inv_weights.dims(1);
 
-    af::array results = af::constant(0, coords.dims(0), coords.dims(1));
+    af::array grad = 2 * ifs::PI * coords(af::span, af::span, 2) - ifs::PI;
 
     // we could add the previous inputs into the cost function
     // adding into the stdev part, so the colors will gradually
     // have more weight
-    for(int i=0; i<pop_size; i++)
-    {
-        // Add weight to each loss
-        // after a few iterations we shouldn't worry too much
-        // about putting points close to each other
-        af::array content_loss = af::abs(
-            // 1 / weights because we want -max (optimizing towards)
-            // the minimum
-            af::approx2(1/(c_weights + grad_weights * img_gradient + 1),
-                x(i, af::span), y(i, af::span)) *
-            (af::approx2(img_gradient, x(i, af::span), y(i, af::span)) - 
-            grad(i, af::span)));
-
-        af::array variance_loss = // we don't want the same inputs 
-            var_weights * .1f * af::tile(1/af::stdev(x(i, af::span), AF_VARIANCE_DEFAULT, 1) + 
-            1/af::stdev(y(i, af::span), AF_VARIANCE_DEFAULT, 1), 1, coords.dims(1));
-
-        results(i, af::span) = content_loss + variance_loss;        
-    }
+
+    // x and y are (pop_size, dna_size_x), so each approx2 call
+    // samples the whole population at once
+    af::array content_loss = af::abs(
+        af::approx2(inv_weights, x, y) *
+        (af::approx2(gradient, x, y) - grad));
+
+    // we don't want the same inputs
+    // reducing along dim 1 gives one stdev per individual
+    af::array variance_loss = var_weights * .1f * af::tile(
+        1/af::stdev(x, AF_VARIANCE_DEFAULT, 1) + 
+        1/af::stdev(y, AF_VARIANCE_DEFAULT, 1), 1, coords.dims(1));
+
+    af::array results = content_loss + variance_loss;
 
     return af::sum(
         -(af::pow(results, 2)
@@ -207,45 +407,229 @@ const af::array Painter::fitness_func(af::array coords)
 }
 
 
-void Painter::run(bool save)
+void Painter::run(bool save, bool resume)
 {
     float og_weights = var_weights;
-    float mutation_rate = 0.001f;
     int frame_n = 0;
+    int start = 0;
+
+    if (save && !frame_writer)
+        frame_writer = std::make_shared<FrameWriter>();
 
-    for (int i=0; i<loops; i++)
+    Checkpoint ckpt;
+    std::unique_ptr<Checkpointer> checkpointer;
+    if (!checkpoint_path.empty())
     {
-        GeneticAlgorithm gal(pop_size, dna_size_x, 
-        dna_size_y, mutation_rate, iters);
+        checkpointer = std::make_unique<Checkpointer>(
+            checkpoint_path, checkpoint_interval);
+        if (resume && checkpointer->load(ckpt))
+        {
+            start = load_state(ckpt, &frame_n);
+            std::cout << "resuming from loop " << start + 1 << std::endl;
+        }
+    }
 
-        gal.run(*this);
-        af::array best = gal.get_best();
+    // every level gets at least a loop, so the
+    // last ones always paint the full resolution
+    if (pyramid_levels > loops || pyramid_levels < 1)
+    {
+        std::cout << "Using " << std::max(1, std::min(pyramid_levels, loops)) <<
+            " pyramid levels instead of " << pyramid_levels << std::endl;
+        pyramid_levels = std::max(1, std::min(pyramid_levels, loops));
+    }
+    if (!level_strokes.empty() && level_strokes.size() < pyramid_levels)
+    {
+        std::cout << "level_strokes has " << level_strokes.size() << 
+            " values for " << pyramid_levels << " pyramid levels, using " <<
+            dna_size_x << " strokes in every level" << std::endl;
+        level_strokes.clear();
+    }
+    int level_loops = loops / pyramid_levels;
+
+    if (metrics && (islands > 1 || focus_tiles > 0))
+        std::cout << "Metrics are not recorded with islands or focus tiles" << 
+            std::endl;
+
+    for (int i=start; i<loops; i++)
+    {
+        int l = std::min(i / level_loops, pyramid_levels - 1);
+        if (l != level)
+            set_level(l);
+        int strokes = level_strokes.empty() ? dna_size_x : level_strokes[l];
+
+        if (checkpointer)
+            checkpointer->add_state = [this, i, &frame_n](Checkpoint& c)
+            {
+                save_state(c, i, frame_n);
+            };
+
+        af::array best;
+        if (focus_tiles > 0)
+        {
+            best = run_focused(strokes, mutation_rate);
+        }
+        else if (islands > 1)
+        {
+            IslandModel gal(islands, pop_size, strokes, 
+                dna_size_y, mutation_rate, iters, migration_interval);
+            gal.gene_storage = gene_storage;
+
+            gal.run(*this);
+            best = gal.get_best();
+        }
+        else
+        {
+            GeneticAlgorithm gal(pop_size, strokes, 
+            dna_size_y, mutation_rate, iters);
+            gal.gene_storage = gene_storage;
+            gal.metrics = metrics;
+            gal.checkpointer = checkpointer.get();
+            gal.convergence = convergence.get();
+            if (i == start && ckpt.has("population"))
+                gal.load_state(ckpt);
+
+            gal.run(*this);
+            best = gal.get_best();
+
+            if (convergence && convergence->stats.stopped_early)
+                std::cout << "loop " << i + 1 << " converged after " << 
+                    convergence->stats.generations << " generations" << std::endl;
+        }
 
         best = af::reorder(best, 1, 2, 0);
 
         // instead of just painting over the image
         // we should only paint parts with lower losses
-        af::array img = make_image(best, current_img, 
+        af::array img = make_image(best, precision::load(current_img), 
             save, &frame_n, true);
-        c_weights = calculate_weights(img);
-        current_img = img;
+        update_weights(img);
+        current_img = precision::store(img, canvas_storage);
 
         // adjust brush size for fine tunning
         if (i == loops / 2)
-            brush = af::resize(0.25f, brush);
+        {
+            full_brush = af::resize(0.25f, full_brush);
+            update_brush();
+        }
         if (i == 3 * loops / 4)
-            brush = af::resize(0.8f, brush);
+        {
+            full_brush = af::resize(0.8f, full_brush);
+            update_brush();
+        }
 
+        // the loop is done, the next one starts
+        // without a population
+        if (checkpointer)
+        {
+            checkpointer->add_state = [this, i, &frame_n](Checkpoint& c)
+            {
+                save_state(c, i + 1, frame_n);
+            };
+            checkpointer->save(Checkpoint());
+        }
         
         if (i % 5 == 0 || i == iters - 1)
             std::cout << "finished iteration " << 
                 i + 1 << std::endl;
     }
 
+    if (checkpointer)
+        checkpointer->wait();
+    if (frame_writer)
+        frame_writer->flush();
+
     var_weights = og_weights;
 }
 
 
+af::array Painter::run_focused(int strokes, float mutation_rate)
+{
+    int w = c_weights.dims(0);
+    int h = c_weights.dims(1);
+    int ts = std::min(focus_tile_size, std::max(w, h));
+    int nx = (w + ts - 1) / ts;
+    int ny = (h + ts - 1) / ts;
+
+    // summed weights of each tile, padding the canvas
+    // so it splits evenly
+    af::array padded = af::constant(0, nx * ts, ny * ts);
+    padded(af::seq(w), af::seq(h)) = c_weights;
+    af::array tile_weights = af::sum(af::sum(
+        af::moddims(padded, ts, nx, ts, ny), 0), 2);
+
+    std::vector<float> weights(nx * ny);
+    tile_weights.host(weights.data());
+
+    int k = std::min(focus_tiles, nx * ny);
+    std::vector<int> order(nx * ny);
+    std::iota(order.begin(), order.end(), 0);
+    std::partial_sort(order.begin(), order.begin() + k, order.end(),
+        [&weights](int a, int b) { return weights[a] > weights[b]; });
+
+    // the fitness function needs at least two
+    // strokes for their position variance
+    int tile_strokes = std::max(2, strokes / k);
+    std::vector<af::array> bests(k);
+
+    auto paint_tile = [&](int t)
+    {
+        int tx = order[t] % nx;
+        int ty = order[t] / nx;
+        // border tiles are clipped to the canvas
+        TileScore score(*this, 
+            (float)(tx * ts) / w, (float)(ty * ts) / h,
+            (float)std::min(ts, w - tx * ts) / w, 
+            (float)std::min(ts, h - ty * ts) / h);
+
+        GeneticAlgorithm gal(pop_size, tile_strokes, 
+            dna_size_y, mutation_rate, iters);
+        gal.gene_storage = gene_storage;
+        gal.run(score);
+        bests[t] = score.to_canvas(gal.get_best());
+    };
+
+    if (focus_concurrent)
+    {
+        int device = af::getDevice();
+        std::vector<std::thread> threads;
+        std::vector<std::exception_ptr> errors(k);
+        for (int t=0; t<k; t++)
+        {
+            threads.emplace_back([&, t]()
+            {
+                try
+                {
+                    af::setDevice(device);
+                    paint_tile(t);
+                    af::sync();
+                }
+                catch (...)
+                {
+                    errors[t] = std::current_exception();
+                }
+            });
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+
+        for (auto& error : errors)
+            if (error)
+                std::rethrow_exception(error);
+    }
+    else
+    {
+        for (int t=0; t<k; t++)
+            paint_tile(t);
+    }
+
+    af::array best = bests[0];
+    for (int t=1; t<k; t++)
+        best = af::join(1, best, bests[t]);
+    return best;
+}
+
+
 af::array Painter::calculate_weights(af::array c_img) const
 {
     af::array _target_img = target_image;
@@ -266,6 +650,111 @@ af::array Painter::calculate_weights(af::array c_img) const
 }
 
 
+void Painter::update_weights(af::array c_img)
+{
+    c_weights = calculate_weights(c_img);
+    refresh_weight_maps();
+}
+
+
+void Painter::refresh_weight_maps()
+{
+    // the gradient never changes, so it is only rebuilt
+    // when the requested level changes
+    if (gradient_mips.size() != fitness_level + 1)
+    {
+        gradient_mips = {img_gradient};
+        for (int l=0; l<fitness_level; l++)
+            gradient_mips.push_back(af::resize(0.5f, 
+                gradient_mips.back(), AF_INTERP_BILINEAR));
+    }
+
+    // 1 / weights because we want -max (optimizing towards)
+    // the minimum
+    inv_weights_mips = {1/(c_weights + grad_weights * img_gradient + 1)};
+    for (int l=0; l<fitness_level; l++)
+        inv_weights_mips.push_back(af::resize(0.5f, 
+            inv_weights_mips.back(), AF_INTERP_BILINEAR));
+}
+
+
+void Painter::set_level(int _level)
+{
+    level = _level;
+    float f = 1.0f / (1 << (pyramid_levels - 1 - level));
+
+    if (f == 1.0f)
+    {
+        target_image = base_target;
+        img_gradient = base_gradient;
+    }
+    else
+    {
+        target_image = af::resize(f, base_target, AF_INTERP_BILINEAR);
+        img_gradient = af::resize(f, base_gradient, AF_INTERP_BILINEAR);
+    }
+
+    // the gradient changed, so its mips must be rebuilt
+    gradient_mips.clear();
+
+    if (current_img.dims(0) != target_image.dims(0) ||
+        current_img.dims(1) != target_image.dims(1))
+        current_img = precision::store(af::resize(
+            precision::load(current_img), target_image.dims(0),
+            target_image.dims(1), AF_INTERP_BILINEAR), canvas_storage);
+    update_weights(precision::load(current_img));
+    update_brush();
+
+    std::cout << "pyramid level " << level + 1 << "/" << pyramid_levels <<
+        ", target image " << target_image.dims() << std::endl;
+}
+
+
+void Painter::update_brush()
+{
+    float f = 1.0f / (1 << (pyramid_levels - 1 - std::max(level, 0)));
+    brush = f == 1.0f ? full_brush : af::resize(full_brush,
+        std::max(1, (int)std::round(f * full_brush.dims(0))),
+        std::max(1, (int)std::round(f * full_brush.dims(1))),
+        AF_INTERP_BILINEAR);
+    build_brush_atlas();
+}
+
+
+void Painter::build_brush_atlas()
+{
+    brush_atlas = SpriteAtlas(brush, rotation_steps);
+}
+
+
+void Painter::save_state(Checkpoint& ckpt, int loop, int frame_n) const
+{
+    ckpt.set("current_img", precision::load(current_img));
+    ckpt.set("c_weights", c_weights);
+    ckpt.set("loop", (long long)loop);
+    ckpt.set("frame_n", (long long)frame_n);
+    ckpt.set("brush_size_x", (long long)full_brush.dims(0));
+    ckpt.set("brush_size_y", (long long)full_brush.dims(1));
+}
+
+
+int Painter::load_state(const Checkpoint& ckpt, int* frame_n)
+{
+    current_img = precision::store(
+        ckpt.get_array("current_img"), canvas_storage);
+    c_weights = ckpt.get_array("c_weights");
+    refresh_weight_maps();
+
+    full_brush = af::resize(full_brush, ckpt.get_int("brush_size_x"), 
+        ckpt.get_int("brush_size_y"));
+    // the level is set again from the loop index
+    level = -1;
+
+    *frame_n = ckpt.get_int("frame_n");
+    return ckpt.get_int("loop");
+}
+
+
 af::array Painter::get_target_img() const
 {
     return target_image;
@@ -273,7 +762,7 @@ af::array Painter::get_target_img() const
 
 af::array Painter::get_current_img() const
 {
-    return current_img;
+    return precision::load(current_img);
 }
 
 af::array Painter::get_current_weights() const
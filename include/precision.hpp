@@ -0,0 +1,69 @@
+#pragma once
+
+#include <arrayfire.h>
+
+
+/*
+ * Storage formats for arrays holding values within the
+ * range of 0-1. Values are stored in the smaller format
+ * and converted back to f32 for every computation
+ */
+namespace precision
+{
+    enum Storage
+    {
+        F32, // full precision
+        F16, // half float, ~3 decimal digits
+        U16, // 16 bits fixed point
+        U8   // 8 bits fixed point, enough for colors
+    };
+
+
+    /*
+     * Converts a f32 array within the range of 0-1
+     * into the given storage format. If below_one is set
+     * the values are kept below 1 (genes are used as
+     * indices), clamping to the largest value below 1
+     * the format holds
+     */
+    af::array store(const af::array& arr, Storage storage, 
+        bool below_one=false)
+    {
+        switch (storage)
+        {
+        case F16:
+            // 1 - 2^-11, the largest half float below 1
+            return (below_one ? 
+                af::clamp(arr, 0.0, 0.99951171875) : arr).as(f16);
+        case U16:
+            return (af::clamp(arr, 0.0, below_one ? 65534.0 / 65535 : 1.0) * 
+                65535.0f + 0.5f).as(u16);
+        case U8:
+            return (af::clamp(arr, 0.0, below_one ? 254.0 / 255 : 1.0) * 
+                255.0f + 0.5f).as(u8);
+        default:
+            return arr;
+        }
+    }
+
+
+    /*
+     * Converts a stored array back into f32. The format
+     * is taken from the array type, so f32 arrays are
+     * returned as they are
+     */
+    af::array load(const af::array& arr)
+    {
+        switch (arr.type())
+        {
+        case f16:
+            return arr.as(f32);
+        case u16:
+            return arr.as(f32) / 65535.0f;
+        case u8:
+            return arr.as(f32) / 255.0f;
+        default:
+            return arr;
+        }
+    }
+}
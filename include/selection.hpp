@@ -0,0 +1,181 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <iostream>
+#include <arrayfire.h>
+
+
+/*
+ * Chooses which individuals of the population
+ * are used as mates during crossover
+ */
+class SelectionStrategy
+{
+public:
+    virtual ~SelectionStrategy() {}
+    /*
+     * Receives the (pop_size, 1) scores and returns the
+     * indices of n mates. Higher scores are better
+     */
+    virtual af::array select(const af::array& scores, int n, 
+        af::randomEngine& engine) const = 0;
+    /*
+     * Whether the fitter parent should pass on more genes
+     * instead of the fixed 50% mask
+     */
+    bool proportional_crossover = true;
+
+protected:
+    /*
+     * Stochastic universal sampling, n equally spaced
+     * pointers over the cumulative weights
+     */
+    static af::array sus(const af::array& weights, int n,
+        af::randomEngine& engine);
+};
+
+
+/*
+ * Everyone breeds with the best individual
+ */
+class BestSelection : public SelectionStrategy
+{
+public:
+    BestSelection() { proportional_crossover = false; }
+    af::array select(const af::array& scores, int n, 
+        af::randomEngine& engine) const override;
+};
+
+
+/*
+ * Each mate is the best of k random individuals
+ */
+class TournamentSelection : public SelectionStrategy
+{
+public:
+    TournamentSelection(int k=3) : k(k) {}
+    af::array select(const af::array& scores, int n, 
+        af::randomEngine& engine) const override;
+    int k;
+};
+
+
+/*
+ * Mates are sampled proportionally to their rank,
+ * which ignores the scale of the scores
+ */
+class RankSelection : public SelectionStrategy
+{
+public:
+    af::array select(const af::array& scores, int n, 
+        af::randomEngine& engine) const override;
+};
+
+
+/*
+ * Mates are sampled proportionally to their score
+ * with stochastic universal sampling
+ */
+class RouletteSelection : public SelectionStrategy
+{
+public:
+    af::array select(const af::array& scores, int n, 
+        af::randomEngine& engine) const override;
+};
+
+
+/*
+ * Creates a strategy from its name: best, tournament,
+ * rank or roulette
+ */
+std::shared_ptr<SelectionStrategy> make_selection(
+    const std::string& name, int k=3)
+{
+    if (name == "tournament")
+        return std::make_shared<TournamentSelection>(k);
+    if (name == "rank")
+        return std::make_shared<RankSelection>();
+    if (name == "roulette")
+        return std::make_shared<RouletteSelection>();
+    if (name != "best")
+        std::cout << "Unknown selection " << name << 
+            ", using best" << std::endl;
+    return std::make_shared<BestSelection>();
+}
+
+
+af::array SelectionStrategy::sus(const af::array& weights, int n,
+    af::randomEngine& engine)
+{
+    int pop_size = weights.dims(0);
+
+    af::array cum = af::accum(weights);
+    cum /= af::tile(cum(-1), pop_size);
+
+    af::array pointers = (af::range(af::dim4(n)) + 
+        af::tile(af::randu(af::dim4(1), f32, engine), n)) / n;
+
+    // the selected index is the number of cumulative
+    // weights below each pointer
+    af::array below = af::tile(cum.T(), n) < af::tile(pointers, 1, pop_size);
+    return af::min(af::sum(below.as(f32), 1), pop_size - 1).as(u32);
+}
+
+
+af::array BestSelection::select(const af::array& scores, int n, 
+    af::randomEngine&) const
+{
+    af::array best_score;
+    af::array best_idx;
+    af::max(best_score, best_idx, scores, 0);
+    return af::tile(best_idx, n);
+}
+
+
+af::array TournamentSelection::select(const af::array& scores, int n, 
+    af::randomEngine& engine) const
+{
+    int pop_size = scores.dims(0);
+
+    // (n, k) random contenders
+    af::array contenders = af::flat(af::floor(
+        af::randu(af::dim4(n, k), f32, engine) * pop_size).as(u32));
+    af::array contender_scores = af::moddims(scores(contenders), n, k);
+
+    af::array win_score;
+    af::array win_col;
+    af::max(win_score, win_col, contender_scores, 1);
+
+    return contenders(af::range(af::dim4(n), 0, u32) + win_col * n);
+}
+
+
+af::array RankSelection::select(const af::array& scores, int n, 
+    af::randomEngine& engine) const
+{
+    int pop_size = scores.dims(0);
+
+    af::array sorted;
+    af::array order;
+    af::sort(sorted, order, af::flat(scores), 0, true);
+
+    // the worst gets weight 1 and the best pop_size
+    af::array ranks = af::constant(0, pop_size);
+    ranks(order) = af::range(af::dim4(pop_size)) + 1;
+
+    return sus(ranks, n, engine);
+}
+
+
+af::array RouletteSelection::select(const af::array& scores, int n, 
+    af::randomEngine& engine) const
+{
+    int pop_size = scores.dims(0);
+
+    // shift so every weight is positive, the small
+    // constant avoids dividing by zero when all
+    // scores are the same
+    af::array weights = scores - af::tile(af::min(scores, 0), pop_size) + 1e-6f;
+    return sus(weights, n, engine);
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include <arrayfire.h>
+
+#include "image_functions.hpp"
+
+
+/*
+ * Holds a sprite pre-rendered at a fixed set of angles
+ * and scales, so it can be looked up instead of being
+ * rotated and resized every time it is drawn
+ */
+class SpriteAtlas
+{
+public:
+    SpriteAtlas() {}
+    /*
+     * Renders the sprite at angle_steps angles spanning
+     * [-pi, pi) and scale_steps scales spanning
+     * [min_scale, max_scale]. A single angle step keeps
+     * the sprite unrotated
+     */
+    SpriteAtlas(const af::array& sprite, int angle_steps=32, 
+        int scale_steps=1, float min_scale=1.0f, float max_scale=1.0f,
+        af_interp_type method=AF_INTERP_BICUBIC_SPLINE);
+
+    /*
+     * Returns the cell closest to the given angle and scale
+     * genes, both within the range of 0-1
+     */
+    int index(float angle, float scale) const;
+    af::array index(const af::array& angles, const af::array& scales) const;
+    /*
+     * Returns the cells at the given indices, stacked along
+     * the fourth dimension
+     */
+    af::array get(int idx) const;
+    af::array get(const af::array& idxs) const;
+    /*
+     * Returns the quantized scale used for the given gene
+     */
+    float scale(float gene) const;
+    /*
+     * Side of the square cells
+     */
+    int size() const;
+
+    int angle_steps = 1;
+    int scale_steps = 1;
+    float min_scale = 1.0f;
+    float max_scale = 1.0f;
+
+private:
+    // (size, size, channels, angle_steps * scale_steps)
+    af::array cells;
+};
+
+
+SpriteAtlas::SpriteAtlas(const af::array& sprite, int angle_steps, 
+    int scale_steps, float min_scale, float max_scale,
+    af_interp_type method) :
+        angle_steps(angle_steps), scale_steps(scale_steps),
+        min_scale(min_scale), max_scale(max_scale)
+{
+    int size_x = sprite.dims(0);
+    int size_y = sprite.dims(1);
+
+    // the diagonal of the biggest scale fits every rotation
+    int _size = std::max(1, (int)std::ceil(max_scale * 
+        std::sqrt(size_x * size_x + size_y * size_y)));
+
+    cells = af::constant(0, _size, _size, sprite.dims(2), 
+        angle_steps * scale_steps);
+
+    af_interp_type resize_method = method == AF_INTERP_NEAREST ?
+        AF_INTERP_NEAREST : AF_INTERP_BILINEAR;
+
+    for (int s=0; s<scale_steps; s++)
+    {
+        float gene = scale_steps == 1 ? 1.0f : s / (scale_steps - 1.0f);
+        float _scale = scale(gene);
+        int s_size_x = std::max(1, (int)std::round(_scale * size_x));
+        int s_size_y = std::max(1, (int)std::round(_scale * size_y));
+
+        af::array scaled = af::resize(sprite, s_size_x, s_size_y, 
+            resize_method);
+
+        // center the sprite so it rotates around its middle
+        int off_x = (_size - s_size_x) / 2;
+        int off_y = (_size - s_size_y) / 2;
+        af::array padded = af::constant(0, _size, _size, sprite.dims(2));
+        padded(af::seq(off_x, off_x + s_size_x - 1),
+            af::seq(off_y, off_y + s_size_y - 1), af::span) = scaled;
+
+        for (int a=0; a<angle_steps; a++)
+        {
+            // a single angle keeps the sprite unrotated
+            float angle = angle_steps == 1 ? 0.0f :
+                2 * ifs::PI * a / angle_steps - ifs::PI;
+            cells(af::span, af::span, af::span, s * angle_steps + a) = 
+                af::rotate(padded, angle, true, method);
+        }
+    }
+}
+
+
+int SpriteAtlas::index(float angle, float scale) const
+{
+    int a = (int)std::round(angle * angle_steps) % angle_steps;
+    int s = std::round(scale * (scale_steps - 1));
+    return s * angle_steps + a;
+}
+
+
+af::array SpriteAtlas::index(const af::array& angles, 
+    const af::array& scales) const
+{
+    af::array a = af::round(angles * angle_steps).as(u32) % angle_steps;
+    af::array s = af::round(scales * (scale_steps - 1)).as(u32);
+    return s * angle_steps + a;
+}
+
+
+af::array SpriteAtlas::get(int idx) const
+{
+    return cells(af::span, af::span, af::span, idx);
+}
+
+
+af::array SpriteAtlas::get(const af::array& idxs) const
+{
+    return cells(af::span, af::span, af::span, idxs);
+}
+
+
+float SpriteAtlas::scale(float gene) const
+{
+    if (scale_steps == 1)
+        return max_scale;
+
+    gene = std::round(gene * (scale_steps - 1)) / (scale_steps - 1);
+    return min_scale + gene * (max_scale - min_scale);
+}
+
+
+int SpriteAtlas::size() const
+{
+    return cells.dims(0);
+}
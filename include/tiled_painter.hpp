@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <arrayfire.h>
+
+#include "painter.hpp"
+
+
+/*
+ * Paints images too big to fit in memory. The target is
+ * split once into overlapping tiles stored on disk, each
+ * tile is painted on its own and its interior is streamed
+ * into the output file, so only one tile is in memory at
+ * a time
+ */
+class TiledPainter
+{
+public:
+    TiledPainter(const char *img_path, const char *brush_path,
+        float brush_scale, int iters, int dna_size_x, 
+        int dna_size_y, int loops=10, int pop_size=100,
+        float var_weights=1.0f, float grad_weights=1.0f,
+        int tile_size=1024, std::string work_dir="tiles");
+    ~TiledPainter();
+
+    /*
+     * Paints every tile and writes the result
+     * into out_path as a binary ppm image
+     */
+    void run(const char* out_path);
+
+private:
+    struct Tile
+    {
+        // interior of the tile in image coordinates
+        int x;
+        int y;
+        int size_x;
+        int size_y;
+        // interior offset inside the tile with halo
+        int off_x;
+        int off_y;
+        std::string path;
+    };
+
+    float brush_scale;
+    int iters;
+    int dna_size_x;
+    int dna_size_y;
+    int loops;
+    int pop_size;
+    float var_weights;
+    float grad_weights;
+
+    int tile_size;
+    /*
+     * Extra border painted around each tile so strokes
+     * crossing tile edges are not cut. It is the size
+     * of the biggest rotated brush
+     */
+    int halo;
+    int img_size_x;
+    int img_size_y;
+    std::filesystem::path work_dir;
+    std::vector<Tile> tiles;
+    af::array brush;
+
+    /*
+     * Copies the tile interior into its place
+     * in the output file
+     */
+    void write_tile(std::fstream& outfile, std::streamoff header_size,
+        const af::array& img, const Tile& tile) const;
+};
+
+
+TiledPainter::TiledPainter(const char *img_path, const char *brush_path,
+    float brush_scale, int iters, int dna_size_x,
+    int dna_size_y, int loops, int pop_size, 
+    float var_weights, float grad_weights,
+    int tile_size, std::string work_dir) :
+        brush_scale(brush_scale), iters(iters), 
+        dna_size_x(dna_size_x), dna_size_y(dna_size_y),
+        loops(loops), pop_size(pop_size), var_weights(var_weights),
+        grad_weights(grad_weights), tile_size(tile_size),
+        work_dir(work_dir)
+{
+    brush = af::loadImage(brush_path, true) / 255.f;
+    halo = std::ceil(brush_scale * std::sqrt(
+        brush.dims(0) * brush.dims(0) + brush.dims(1) * brush.dims(1)));
+
+    std::filesystem::create_directories(this->work_dir);
+
+    // the whole image is only loaded here, as 8 bits,
+    // to split it into tiles
+    af::array img = af::loadImageNative(img_path);
+    img_size_x = img.dims(0);
+    img_size_y = img.dims(1);
+
+    for (int x=0; x<img_size_x; x+=tile_size)
+    {
+        for (int y=0; y<img_size_y; y+=tile_size)
+        {
+            Tile tile;
+            tile.x = x;
+            tile.y = y;
+            tile.size_x = std::min(tile_size, img_size_x - x);
+            tile.size_y = std::min(tile_size, img_size_y - y);
+
+            int start_x = std::max(0, x - halo);
+            int start_y = std::max(0, y - halo);
+            int end_x = std::min(img_size_x, x + tile.size_x + halo);
+            int end_y = std::min(img_size_y, y + tile.size_y + halo);
+            tile.off_x = x - start_x;
+            tile.off_y = y - start_y;
+
+            tile.path = (this->work_dir / ("tile_" + std::to_string(x) + 
+                "_" + std::to_string(y) + ".png")).string();
+            af::saveImageNative(tile.path.c_str(), 
+                img(af::seq(start_x, end_x - 1), af::seq(start_y, end_y - 1),
+                    af::seq(std::min(3, (int)img.dims(2)))));
+
+            tiles.push_back(tile);
+        }
+    }
+
+    std::cout << "split " << img.dims() << " into " << 
+        tiles.size() << " tiles with halo " << halo << std::endl;
+}
+
+
+TiledPainter::~TiledPainter()
+{
+
+}
+
+
+void TiledPainter::run(const char* out_path)
+{
+    std::fstream outfile(out_path, std::ios::out | 
+        std::ios::in | std::ios::binary | std::ios::trunc);
+
+    // ppm width is the number of columns
+    std::string header = "P6\n" + std::to_string(img_size_y) + " " +
+        std::to_string(img_size_x) + "\n255\n";
+    outfile << header;
+
+    // allocate the whole file so tiles can be written anywhere
+    std::streamoff file_size = header.size() + 
+        (std::streamoff)img_size_x * img_size_y * 3;
+    outfile.seekp(file_size - 1);
+    outfile.put(0);
+
+    for (int i=0; i<tiles.size(); i++)
+    {
+        const Tile& tile = tiles[i];
+        af::array target = af::loadImage(tile.path.c_str(), 1) / 255.f;
+
+        Painter painter(target, brush, brush_scale, iters, dna_size_x,
+            dna_size_y, loops, pop_size, var_weights, grad_weights);
+        painter.run();
+
+        write_tile(outfile, header.size(), painter.get_current_img(), tile);
+        std::cout << "finished tile " << i + 1 << "/" << 
+            tiles.size() << std::endl;
+    }
+}
+
+
+void TiledPainter::write_tile(std::fstream& outfile, 
+    std::streamoff header_size, const af::array& img, 
+    const Tile& tile) const
+{
+    af::array interior = img(
+        af::seq(tile.off_x, tile.off_x + tile.size_x - 1),
+        af::seq(tile.off_y, tile.off_y + tile.size_y - 1), af::seq(3));
+
+    std::vector<uint8_t> data(tile.size_x * tile.size_y * 3);
+    (af::clamp(interior, 0, 1) * 255).as(u8).host(data.data());
+
+    // arrayfire is column major while ppm rows are
+    // interleaved rgb, so each row is repacked
+    int n_pixels = tile.size_x * tile.size_y;
+    std::vector<uint8_t> row(tile.size_y * 3);
+    for (int x=0; x<tile.size_x; x++)
+    {
+        for (int y=0; y<tile.size_y; y++)
+            for (int c=0; c<3; c++)
+                row[3 * y + c] = data[x + y * tile.size_x + c * n_pixels];
+
+        outfile.seekp(header_size + 
+            ((std::streamoff)(tile.x + x) * img_size_y + tile.y) * 3);
+        outfile.write(reinterpret_cast<const char*>(row.data()), row.size());
+    }
+}
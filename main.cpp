@@ -1,7 +1,11 @@
+#include <vector>
+#include <cstring>
+#include <cstdlib>
 #include <iostream>
 #include <arrayfire.h>
 #include "include/genetic_algorithm.hpp"
 #include "include/painter.hpp"
+#include "include/tiled_painter.hpp"
 
 af::array consts = af::tile(af::randu(1, 20, 20), 500);
 
@@ -27,10 +31,29 @@ int main(int argc, char **argv)
     const char* brush_path;
 
     // parse arguments
-    if (argc==3)
+    std::vector<const char*> args;
+    bool resume = false;
+    int tile_size = 0;
+    const char* video_path = nullptr;
+    const char* checkpoint_path = "";
+    for (int i=1; i<argc; i++)
     {
-        img_path = argv[1];
-        brush_path = argv[2];
+        if (std::strcmp(argv[i], "--resume") == 0)
+            resume = true;
+        else if (std::strcmp(argv[i], "--tile") == 0 && i + 1 < argc)
+            tile_size = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--video") == 0 && i + 1 < argc)
+            video_path = argv[++i];
+        else if (std::strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+            checkpoint_path = argv[++i];
+        else
+            args.push_back(argv[i]);
+    }
+
+    if (args.size()==2)
+    {
+        img_path = args[0];
+        brush_path = args[1];
     }
     else
     {
@@ -48,11 +71,31 @@ int main(int argc, char **argv)
     float grad_weights = 1.2f;
     bool save = 0;
 
+    // big images are painted tile by tile straight to disk
+    if (tile_size > 0)
+    {
+        TiledPainter painter(img_path, brush_path,
+            brush_scale, iters, dna_size_x, dna_size_y, 
+            loops, pop_size, var_weights, grad_weights, tile_size);
+        painter.run("../imgs/tiled.ppm");
+        return 0;
+    }
+
     Painter painter(img_path, brush_path,
         brush_scale, iters, dna_size_x, dna_size_y, 
         loops, pop_size, var_weights, grad_weights);
 
-    painter.run(save);
+    painter.checkpoint_path = checkpoint_path;
+    // frames go straight to ffmpeg instead of imgs/process
+    if (video_path)
+    {
+        save = 1;
+        painter.frame_writer = std::make_shared<FrameWriter>(
+            16, FrameWriter::DROP_OLDEST);
+        painter.frame_writer->open_pipe(
+            std::string("sh ../make_video.sh {width}x{height} ") + video_path);
+    }
+    painter.run(save, resume);
 
     auto target_image = painter.get_target_img();
     auto current_img = painter.get_current_img();
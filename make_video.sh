@@ -1 +1,8 @@
-ffmpeg -i imgs/process/%d.png -vf fps=20 -vf "pad=ceil(iw/2)*2:ceil(ih/2)*2" -vcodec libx264 -y -an video.mp4
\ No newline at end of file
+# builds video.mp4 from the frames saved in imgs/process, or
+# from raw rgba frames read from stdin when given their size
+#   make_video.sh <width>x<height> [out.mp4]
+if [ $# -ge 1 ]; then
+    ffmpeg -f rawvideo -pix_fmt rgba -s $1 -r 20 -i - -vf "pad=ceil(iw/2)*2:ceil(ih/2)*2" -vcodec libx264 -pix_fmt yuv420p -y -an ${2:-video.mp4}
+else
+    ffmpeg -i imgs/process/%d.png -vf fps=20 -vf "pad=ceil(iw/2)*2:ceil(ih/2)*2" -vcodec libx264 -y -an video.mp4
+fi
@@ -1,4 +1,5 @@
 #include <cstring>
+#include <memory>
 #include <vector>
 #include <string>
 #include <sstream>
@@ -51,6 +52,14 @@ int main(int argc, char **argv)
     const char* img_path = parse_option("-t", "../imgs/reserva_t.png", argc, argv);
     const char* save_name = parse_option("-s", "../imgs/packer_out.png", argc, argv);
     int callback = parse_option("-c", 1, argc, argv);
+    const char* checkpoint_path = parse_option("-x", "", argc, argv);
+    // pack file keeping the resized objects between runs
+    const char* cache_path = parse_option("-l", "", argc, argv);
+    // per generation metrics, .csv or .jsonl
+    const char* metrics_path = parse_option("-j", "", argc, argv);
+    bool resume = false;
+    for (int i=1; i<argc; i++)
+        resume = resume || std::strcmp(argv[i], "--resume") == 0;
 
     // metaparameters
     float scale = parse_option("-r", 0.05f, argc, argv);
@@ -58,6 +67,15 @@ int main(int argc, char **argv)
     int max_objs = parse_option("-o", 120, argc, argv);
     int iters = parse_option("-i", 800, argc, argv);
     float mutation_rate = parse_option("-m", 0.001f, argc, argv);
+    const char* selection = parse_option("-g", "best", argc, argv);
+    int tournament_size = parse_option("-k", 3, argc, argv);
+    int islands = parse_option("-n", 1, argc, argv);
+    // grid used to skip drawing bad individuals, 0 disables it
+    int grid_cells = parse_option("-e", 0, argc, argv);
+    // generations between convergence checks, the run stops once the
+    // best score improves less than 1e-4 (relative) over them and
+    // the mutation rate adapts to them. 0 disables it
+    int convergence_window = parse_option("-y", 0, argc, argv);
 
     // weights
     float area_weight = parse_option("-a", 800, argc, argv);
@@ -66,6 +84,7 @@ int main(int argc, char **argv)
     std::cout << "\nStarting with parameters: scale " << scale <<
         ", population size " << pop_size << ", max objects " << max_objs <<
         ", iterations " << iters << ", mutation rate " << mutation_rate << 
+        ", selection " << selection << ", islands " << islands <<
         ", callback: " << callback << std::endl;
 
     std::cout << "\nWeights :area weight " <<
@@ -78,11 +97,24 @@ int main(int argc, char **argv)
     for (const auto & entry : fs::directory_iterator(obj_dir))
         obj_pths.push_back(entry.path());
 
-    Packer packer(img_path, obj_pths, scale);
+    Packer packer(img_path, obj_pths, scale, cache_path);
     packer.area_weight = area_weight;
     packer.out_weight = out_weight;
+    packer.selection_strategy = make_selection(selection, tournament_size);
+    packer.islands = islands;
+    packer.grid_cells = grid_cells;
+    if (convergence_window > 0)
+        packer.convergence = std::make_shared<ConvergenceController>(
+            convergence_window);
+    packer.checkpoint_path = checkpoint_path;
+    std::unique_ptr<MetricsSink> metrics;
+    if (std::strlen(metrics_path) > 0)
+    {
+        metrics.reset(metrics::make_sink(metrics_path));
+        packer.metrics = metrics.get();
+    }
     
-    af::array current_img = packer.run(pop_size, max_objs, mutation_rate, iters, 0, callback);
+    af::array current_img = packer.run(pop_size, max_objs, mutation_rate, iters, 0, callback, resume);
     
     packer.save(save_name);
 
@@ -0,0 +1,77 @@
+#include <cstring>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <arrayfire.h>
+
+#include "include/layout.hpp"
+#include "include/packer.hpp"
+
+
+const char* parse_option(const char* option, const char* deflt, 
+    int argc, char**argv)
+{
+    for (int i=1; i<argc; i++)
+    {
+        if (std::strcmp(argv[i], option) == 0)
+            return argv[i+1];
+    }
+    return deflt;
+}
+
+
+template<typename T>
+T parse_option(const char* option, T deflt, 
+    int argc, char**argv)
+{
+    for (int i=1; i<argc; i++)
+    {
+        if (std::strcmp(argv[i], option) == 0)
+        {
+            std::stringstream ss(argv[i+1]);
+            T t;
+            ss >> t;
+            return t;
+        }
+    }
+    return deflt;
+}
+
+
+/*
+ * Renders a layout saved by the packer (.gal file)
+ * at any resolution
+ */
+int main(int argc, char **argv)
+{
+    const char* layout_path = parse_option("-l", "../imgs/packer_out.gal", argc, argv);
+    const char* save_name = parse_option("-s", "replay.png", argc, argv);
+    // resizes the target image
+    float resize = parse_option("-r", 1.0f, argc, argv);
+    // rescales the objects on top of the resize
+    float rescale = parse_option("-rs", 1.0f, argc, argv);
+    // angles and scales each object is pre-rendered at,
+    // big renders need more to avoid visible steps
+    int angle_steps = parse_option("-as", 16, argc, argv);
+    int scale_steps = parse_option("-ss", 8, argc, argv);
+
+    layout::Layout l;
+    if (!layout::load(layout_path, l))
+        return 1;
+
+    std::cout << "Rendering " << l.n_objs << " objects at " <<
+        (int)(resize * l.target_size_x) << "x" << 
+        (int)(resize * l.target_size_y) << std::endl;
+
+    Packer packer(resize * l.target_size_x, resize * l.target_size_y,
+        l.paths, resize * rescale * l.scale);
+    packer.angle_steps = angle_steps;
+    packer.scale_steps = scale_steps;
+    af::array img = packer.replay(l);
+
+    af::array mimg = (img * 255).as(u8);
+    af::saveImageNative(save_name, mimg);
+
+    return 0;
+}